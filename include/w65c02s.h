@@ -48,6 +48,101 @@ extern "C" {
 #define W65C02S_HOOK_EOI 0
 #endif
 
+/* 1: allow hook_trace */
+/* 0: do not allow hook_trace */
+#ifndef W65C02S_HOOK_TRACE
+#define W65C02S_HOOK_TRACE 0
+#endif
+
+/* 1: the RDY line can be held low from callbacks, see w65c02s_hold_rdy */
+/* 0: only w65c02s_stall is available */
+#ifndef W65C02S_RDY
+#define W65C02S_RDY 0
+#endif
+
+/* 1: WAI and STP skip ahead to the end of w65c02s_run_cycles at once */
+/* 0: WAI and STP run cycle by cycle, with a spurious read on each */
+#ifndef W65C02S_IDLE_SKIP
+#define W65C02S_IDLE_SKIP 0
+#endif
+
+/* 1: decimal mode ADC/SBC use lookup tables (512 KiB, filled by init) */
+/* 0: decimal mode ADC/SBC compute the result one digit at a time */
+#ifndef W65C02S_DECIMAL_TABLE
+#define W65C02S_DECIMAL_TABLE 0
+#endif
+
+/* 1: common instruction pairs (e.g. LDA/STA) are dispatched together,
+      only used by w65c02s_run_cycles with W65C02S_COARSE=1 */
+/* 0: every instruction is dispatched separately */
+#ifndef W65C02S_FUSION
+#define W65C02S_FUSION 0
+#endif
+
+/* 1: memory pages can be mapped directly to host memory,
+      see w65c02s_map_pages */
+/* 0: all memory accesses go through the read/write callbacks */
+#ifndef W65C02S_PAGE_TABLE
+#define W65C02S_PAGE_TABLE 0
+#endif
+
+/* N: up to N address ranges can be given their own read/write callbacks,
+      see w65c02s_map_io */
+/* 0: all memory accesses go through the read/write callbacks */
+#ifndef W65C02S_IO_REGIONS
+#define W65C02S_IO_REGIONS 0
+#endif
+
+/* 1: keep track of which memory pages have been written to,
+      see w65c02s_fetch_dirty_pages */
+/* 0: do not keep track of written pages */
+#ifndef W65C02S_DIRTY_PAGES
+#define W65C02S_DIRTY_PAGES 0
+#endif
+
+/* 1: count memory accesses per address, see w65c02s_set_heatmap */
+/* 0: do not count memory accesses */
+#ifndef W65C02S_HEATMAP
+#define W65C02S_HEATMAP 0
+#endif
+
+/* 1: cycle and instruction counters are 64-bit (needs uint64_t),
+      see w65c02s_run_cycles64 */
+/* 0: cycle and instruction counters are unsigned long */
+#ifndef W65C02S_COUNTER_64
+#define W65C02S_COUNTER_64 0
+#endif
+
+/* 1: accesses to some memory pages can take extra cycles,
+      see w65c02s_set_wait_states */
+/* 0: all memory accesses take one cycle */
+#ifndef W65C02S_WAIT_STATES
+#define W65C02S_WAIT_STATES 0
+#endif
+
+/* N: up to N address ranges can be shared with other CPUs, which are caught
+      up before every access to them, see w65c02s_share_range */
+/* 0: no address ranges are shared */
+#ifndef W65C02S_SHARED
+#define W65C02S_SHARED 0
+#endif
+
+/* 1: detect and skip busy-wait loops, see w65c02s_hook_idle_loop */
+/* 0: do not detect busy-wait loops */
+#ifndef W65C02S_IDLE_LOOP
+#define W65C02S_IDLE_LOOP 0
+#endif
+
+/* 1: include the disassembler, see w65c02s_disassemble */
+/* 0: do not include the disassembler */
+#ifndef W65C02S_DISASM
+#define W65C02S_DISASM 0
+#endif
+
+/* if defined, replaces w65c02s_ in the names of all public functions and
+   struct w65c02s_cpu, e.g. #define W65C02S_PREFIX w65c02s_fast_ */
+/* #define W65C02S_PREFIX */
+
 /* 1: has bool without stdbool.h */
 /* 0: does not have bool without stdbool.h */
 #ifndef W65C02S_HAS_BOOL
@@ -92,6 +187,9 @@ typedef unsigned short uint16_t;
 #else
 #error no uint16_t available
 #endif
+#if W65C02S_COUNTER_64
+#error no uint64_t available for W65C02S_COUNTER_64
+#endif
 #endif
 
 #if W65C02S_HAS_BOOL
@@ -111,6 +209,258 @@ typedef int bool;
 #endif
 
 #include <stddef.h>
+#include <limits.h>
+
+/* type of the cycle and instruction counters */
+#if W65C02S_COUNTER_64
+#define W65C02S_COUNT uint64_t
+#define W65C02S_COUNT_MAX UINT64_MAX
+#else
+#define W65C02S_COUNT unsigned long
+#define W65C02S_COUNT_MAX ULONG_MAX
+#endif
+
+#define W65C02S_PASTE_(a, b) a ## b
+#define W65C02S_PASTE(a, b) W65C02S_PASTE_(a, b)
+
+/* CPU state between instructions, see w65c02s_save_state.
+   the layout does not depend on any of the defines above, so that the state
+   can be moved between differently configured (and prefixed) cores. */
+struct w65c02s_state {
+    unsigned long total_cycles;
+    unsigned long total_instructions;
+    /* the bits of the counters that do not fit in an unsigned long,
+       only used with W65C02S_COUNTER_64 where unsigned long is 32-bit */
+    unsigned long total_cycles_high;
+    unsigned long total_instructions_high;
+    /* how many cycles we must still stall */
+    unsigned long stall_cycles;
+    /* run/wait/stop and latched interrupts, currently active interrupts */
+    unsigned cpu_state, int_trig;
+    /* IRQ sources asserted, see w65c02s_irq_source */
+    unsigned long irq_sources;
+    uint16_t pc;
+    uint8_t a, x, y, s, p;
+    /* entering NMI, resetting or IRQ? */
+    bool in_nmi, in_rst, in_irq;
+    /* IRQ held by w65c02s_irq? */
+    bool irq_held;
+};
+
+/* one instruction in a trace, see w65c02s_hook_trace */
+struct w65c02s_trace_record {
+    /* cycle count after the instruction, 64-bit with W65C02S_COUNTER_64 */
+    W65C02S_COUNT cycles;
+    /* address of the opcode, or of the next instruction for interrupts */
+    uint16_t pc;
+    /* opcode, 0 (BRK) for interrupts */
+    uint8_t ir;
+    /* registers after the instruction */
+    uint8_t a, x, y, s, p;
+};
+
+/* kinds of memory accesses counted in a heatmap, see w65c02s_set_heatmap */
+#define W65C02S_HEATMAP_READ 0
+#define W65C02S_HEATMAP_WRITE 1
+#define W65C02S_HEATMAP_FETCH 2
+
+/* number of IRQ sources, see w65c02s_irq_source */
+#define W65C02S_IRQ_SOURCES 32
+
+/* addressing modes of disassembled instructions, see w65c02s_disassemble */
+#define W65C02S_DISASM_IMPLIED              0   /* CLC, ASL A, RTS */
+#define W65C02S_DISASM_IMMEDIATE            1   /* LDA #$12, BRK #$12 */
+#define W65C02S_DISASM_RELATIVE             2   /* BNE $12 */
+#define W65C02S_DISASM_ZEROPAGE_RELATIVE    3   /* BBR0 $12,$34 */
+#define W65C02S_DISASM_ZEROPAGE             4   /* LDA $12 */
+#define W65C02S_DISASM_ZEROPAGE_X           5   /* LDA $12,X */
+#define W65C02S_DISASM_ZEROPAGE_Y           6   /* LDX $12,Y */
+#define W65C02S_DISASM_ZEROPAGE_INDIRECT    7   /* LDA ($12) */
+#define W65C02S_DISASM_ZEROPAGE_INDIRECT_X  8   /* LDA ($12,X) */
+#define W65C02S_DISASM_ZEROPAGE_INDIRECT_Y  9   /* LDA ($12),Y */
+#define W65C02S_DISASM_ABSOLUTE             10  /* LDA $1234 */
+#define W65C02S_DISASM_ABSOLUTE_X           11  /* LDA $1234,X */
+#define W65C02S_DISASM_ABSOLUTE_Y           12  /* LDA $1234,Y */
+#define W65C02S_DISASM_ABSOLUTE_INDIRECT    13  /* JMP ($1234) */
+#define W65C02S_DISASM_ABSOLUTE_INDIRECT_X  14  /* JMP ($1234,X) */
+
+/* room needed for the text of an operand, see w65c02s_disasm_operand */
+#define W65C02S_DISASM_OPERAND_SIZE 10
+
+/* one disassembled instruction, see w65c02s_disassemble */
+struct w65c02s_disasm {
+    /* e.g. "LDA" or "BBR0" */
+    const char *mnemonic;
+    /* address of the opcode */
+    uint16_t address;
+    /* the operand: a value, zero page address or absolute address,
+       or the branch offset for W65C02S_DISASM_RELATIVE. for
+       W65C02S_DISASM_ZEROPAGE_RELATIVE, the zero page address in the low
+       byte and the branch offset in the high byte */
+    uint16_t operand;
+    /* branch target for W65C02S_DISASM_RELATIVE and
+       W65C02S_DISASM_ZEROPAGE_RELATIVE, 0 otherwise */
+    uint16_t target;
+    uint8_t opcode;
+    /* one of W65C02S_DISASM_* */
+    uint8_t mode;
+    /* 1 to 3 bytes */
+    uint8_t length;
+    /* cycles taken at least, without a page crossing, a taken branch or
+       decimal mode */
+    uint8_t cycles;
+};
+
+#endif /* W65C02S_H */
+
+/* public names. with W65C02S_PREFIX, w65c02s_ is replaced by the prefix.
+   the mapping is redone on every inclusion, so that a file may include the
+   declarations of several differently prefixed cores one after another. */
+#undef w65c02s_cpu
+#undef w65c02s_cpu_size
+#undef w65c02s_init
+#undef w65c02s_init_decimal_tables
+#undef w65c02s_run_cycles
+#undef w65c02s_run_cycles64
+#undef w65c02s_sync_to_cycle
+#undef w65c02s_sync_to_cycle64
+#undef w65c02s_run_shared
+#undef w65c02s_step_instruction
+#undef w65c02s_run_instructions
+#undef w65c02s_get_cycle_count
+#undef w65c02s_get_instruction_count
+#undef w65c02s_get_cycle_count64
+#undef w65c02s_get_instruction_count64
+#undef w65c02s_get_cpu_data
+#undef w65c02s_reset_cycle_count
+#undef w65c02s_reset_instruction_count
+#undef w65c02s_is_cpu_waiting
+#undef w65c02s_is_cpu_stopped
+#undef w65c02s_break
+#undef w65c02s_stall
+#undef w65c02s_hold_rdy
+#undef w65c02s_nmi
+#undef w65c02s_reset
+#undef w65c02s_irq
+#undef w65c02s_irq_cancel
+#undef w65c02s_irq_source
+#undef w65c02s_irq_get_sources
+#undef w65c02s_irq_highest_source
+#undef w65c02s_set_overflow
+#undef w65c02s_hook_brk
+#undef w65c02s_hook_brk_cpu
+#undef w65c02s_hook_stp
+#undef w65c02s_hook_stp_cpu
+#undef w65c02s_hook_end_of_instruction
+#undef w65c02s_hook_end_of_instruction_cpu
+#undef w65c02s_hook_idle_loop
+#undef w65c02s_hook_idle_loop_cpu
+#undef w65c02s_hook_trace
+#undef w65c02s_flush_trace
+#undef w65c02s_map_pages
+#undef w65c02s_set_wait_states
+#undef w65c02s_map_io
+#undef w65c02s_unmap_io
+#undef w65c02s_share_range
+#undef w65c02s_unshare_ranges
+#undef w65c02s_fetch_dirty_pages
+#undef w65c02s_set_heatmap
+#undef w65c02s_heatmap_top
+#undef w65c02s_disassemble
+#undef w65c02s_disassemble_range
+#undef w65c02s_disasm_operand
+#undef w65c02s_reg_get_a
+#undef w65c02s_reg_get_x
+#undef w65c02s_reg_get_y
+#undef w65c02s_reg_get_p
+#undef w65c02s_reg_get_s
+#undef w65c02s_reg_get_pc
+#undef w65c02s_reg_set_a
+#undef w65c02s_reg_set_x
+#undef w65c02s_reg_set_y
+#undef w65c02s_reg_set_p
+#undef w65c02s_reg_set_s
+#undef w65c02s_reg_set_pc
+#undef w65c02s_save_state
+#undef w65c02s_load_state
+
+#ifdef W65C02S_PREFIX
+#define W65C02S_NAME(name) W65C02S_PASTE(W65C02S_PREFIX, name)
+#define w65c02s_cpu                     W65C02S_NAME(cpu)
+#define w65c02s_cpu_size                W65C02S_NAME(cpu_size)
+#define w65c02s_init                    W65C02S_NAME(init)
+#define w65c02s_init_decimal_tables     W65C02S_NAME(init_decimal_tables)
+#define w65c02s_run_cycles              W65C02S_NAME(run_cycles)
+#define w65c02s_run_cycles64            W65C02S_NAME(run_cycles64)
+#define w65c02s_sync_to_cycle           W65C02S_NAME(sync_to_cycle)
+#define w65c02s_sync_to_cycle64         W65C02S_NAME(sync_to_cycle64)
+#define w65c02s_run_shared              W65C02S_NAME(run_shared)
+#define w65c02s_step_instruction        W65C02S_NAME(step_instruction)
+#define w65c02s_run_instructions        W65C02S_NAME(run_instructions)
+#define w65c02s_get_cycle_count         W65C02S_NAME(get_cycle_count)
+#define w65c02s_get_instruction_count   W65C02S_NAME(get_instruction_count)
+#define w65c02s_get_cycle_count64       W65C02S_NAME(get_cycle_count64)
+#define w65c02s_get_instruction_count64 W65C02S_NAME(get_instruction_count64)
+#define w65c02s_get_cpu_data            W65C02S_NAME(get_cpu_data)
+#define w65c02s_reset_cycle_count       W65C02S_NAME(reset_cycle_count)
+#define w65c02s_reset_instruction_count W65C02S_NAME(reset_instruction_count)
+#define w65c02s_is_cpu_waiting          W65C02S_NAME(is_cpu_waiting)
+#define w65c02s_is_cpu_stopped          W65C02S_NAME(is_cpu_stopped)
+#define w65c02s_break                   W65C02S_NAME(break)
+#define w65c02s_stall                   W65C02S_NAME(stall)
+#define w65c02s_hold_rdy                W65C02S_NAME(hold_rdy)
+#define w65c02s_nmi                     W65C02S_NAME(nmi)
+#define w65c02s_reset                   W65C02S_NAME(reset)
+#define w65c02s_irq                     W65C02S_NAME(irq)
+#define w65c02s_irq_cancel              W65C02S_NAME(irq_cancel)
+#define w65c02s_irq_source              W65C02S_NAME(irq_source)
+#define w65c02s_irq_get_sources         W65C02S_NAME(irq_get_sources)
+#define w65c02s_irq_highest_source      W65C02S_NAME(irq_highest_source)
+#define w65c02s_set_overflow            W65C02S_NAME(set_overflow)
+#define w65c02s_hook_brk                W65C02S_NAME(hook_brk)
+#define w65c02s_hook_brk_cpu            W65C02S_NAME(hook_brk_cpu)
+#define w65c02s_hook_stp                W65C02S_NAME(hook_stp)
+#define w65c02s_hook_stp_cpu            W65C02S_NAME(hook_stp_cpu)
+#define w65c02s_hook_end_of_instruction W65C02S_NAME(hook_end_of_instruction)
+#define w65c02s_hook_end_of_instruction_cpu                                    \
+                                W65C02S_NAME(hook_end_of_instruction_cpu)
+#define w65c02s_hook_idle_loop          W65C02S_NAME(hook_idle_loop)
+#define w65c02s_hook_idle_loop_cpu      W65C02S_NAME(hook_idle_loop_cpu)
+#define w65c02s_hook_trace              W65C02S_NAME(hook_trace)
+#define w65c02s_flush_trace             W65C02S_NAME(flush_trace)
+#define w65c02s_map_pages               W65C02S_NAME(map_pages)
+#define w65c02s_set_wait_states         W65C02S_NAME(set_wait_states)
+#define w65c02s_map_io                  W65C02S_NAME(map_io)
+#define w65c02s_unmap_io                W65C02S_NAME(unmap_io)
+#define w65c02s_share_range             W65C02S_NAME(share_range)
+#define w65c02s_unshare_ranges          W65C02S_NAME(unshare_ranges)
+#define w65c02s_fetch_dirty_pages       W65C02S_NAME(fetch_dirty_pages)
+#define w65c02s_set_heatmap             W65C02S_NAME(set_heatmap)
+#define w65c02s_heatmap_top             W65C02S_NAME(heatmap_top)
+#define w65c02s_disassemble             W65C02S_NAME(disassemble)
+#define w65c02s_disassemble_range       W65C02S_NAME(disassemble_range)
+#define w65c02s_disasm_operand          W65C02S_NAME(disasm_operand)
+#define w65c02s_reg_get_a               W65C02S_NAME(reg_get_a)
+#define w65c02s_reg_get_x               W65C02S_NAME(reg_get_x)
+#define w65c02s_reg_get_y               W65C02S_NAME(reg_get_y)
+#define w65c02s_reg_get_p               W65C02S_NAME(reg_get_p)
+#define w65c02s_reg_get_s               W65C02S_NAME(reg_get_s)
+#define w65c02s_reg_get_pc              W65C02S_NAME(reg_get_pc)
+#define w65c02s_reg_set_a               W65C02S_NAME(reg_set_a)
+#define w65c02s_reg_set_x               W65C02S_NAME(reg_set_x)
+#define w65c02s_reg_set_y               W65C02S_NAME(reg_set_y)
+#define w65c02s_reg_set_p               W65C02S_NAME(reg_set_p)
+#define w65c02s_reg_set_s               W65C02S_NAME(reg_set_s)
+#define w65c02s_reg_set_pc              W65C02S_NAME(reg_set_pc)
+#define w65c02s_save_state              W65C02S_NAME(save_state)
+#define w65c02s_load_state              W65C02S_NAME(load_state)
+#endif
+
+/* prefixed declarations may be repeated, unprefixed ones only once */
+#if defined(W65C02S_PREFIX) || !defined(W65C02S_H_API)
+#ifndef W65C02S_PREFIX
+#define W65C02S_H_API
+#endif
 
 struct w65c02s_cpu;
 
@@ -150,6 +500,17 @@ void w65c02s_init(struct w65c02s_cpu *cpu,
                   void (*mem_write)(struct w65c02s_cpu *, uint16_t, uint8_t),
                   void *cpu_data);
 
+/** w65c02s_init_decimal_tables
+ *
+ *  Fills the tables used for decimal mode ADC and SBC if the library is
+ *  compiled with W65C02S_DECIMAL_TABLE, and does nothing otherwise.
+ *
+ *  With W65C02S_DECIMAL_TABLE, this must be called once before any CPU
+ *  runs an instruction, and before any other thread uses a CPU. The
+ *  tables are shared by all CPUs with the same W65C02S_PREFIX.
+ */
+void w65c02s_init_decimal_tables(void);
+
 #if W65C02S_LINK
 /** w65c02s_read
  *
@@ -185,8 +546,10 @@ extern void w65c02s_write(uint16_t address, uint8_t value);
  *  value is always correct. Without W65C02S_COARSE the return value is
  *  always the same as `cycles`.
  *
- *  This function is not reentrant. Calling it from a callback (for a memory
- *  read, write, STP, etc.) will result in undefined behavior.
+ *  This function is not reentrant for the same CPU. Calling it from a
+ *  callback (for a memory read, write, STP, etc.) of the CPU being run will
+ *  result in undefined behavior, but it may be called on a different CPU
+ *  instance, such as to catch up another CPU that shares memory.
  *
  *  [Parameter: cpu] The CPU instance to run
  *  [Parameter: cycles] The number of cycles to run
@@ -194,6 +557,90 @@ extern void w65c02s_write(uint16_t address, uint8_t value);
  */
 unsigned long w65c02s_run_cycles(struct w65c02s_cpu *cpu, unsigned long cycles);
 
+#if W65C02S_COUNTER_64
+/** w65c02s_run_cycles64
+ *
+ *  Like w65c02s_run_cycles, but takes and returns a 64-bit number of
+ *  cycles, even where unsigned long is 32-bit.
+ *
+ *  Only available if the library was compiled with W65C02S_COUNTER_64.
+ *
+ *  [Parameter: cpu] The CPU instance to run
+ *  [Parameter: cycles] The number of cycles to run
+ *  [Return value] The number of cycles that were actually run
+ */
+uint64_t w65c02s_run_cycles64(struct w65c02s_cpu *cpu, uint64_t cycles);
+#endif
+
+/** w65c02s_sync_to_cycle
+ *
+ *  Runs the CPU until its cycle count (see w65c02s_get_cycle_count) reaches
+ *  the given value. Unlike w65c02s_run_cycles, w65c02s_break does not stop
+ *  it early.
+ *
+ *  This is meant to be called from the callbacks of another CPU instance,
+ *  to bring this CPU up to date before an access to memory or a device they
+ *  share. It is safe to call even if this CPU is the one currently running
+ *  (in which case it does nothing), so the callbacks can be shared by both.
+ *
+ *  If the CPU is already at or past the given cycle, nothing is run. With
+ *  W65C02S_COARSE, the CPU may end up a few cycles past the given cycle.
+ *
+ *  [Parameter: cpu] The CPU instance to run
+ *  [Parameter: cycle] The cycle count to run the CPU until
+ *  [Return value] The number of cycles that were run
+ */
+unsigned long w65c02s_sync_to_cycle(struct w65c02s_cpu *cpu,
+                                    unsigned long cycle);
+
+#if W65C02S_COUNTER_64
+/** w65c02s_sync_to_cycle64
+ *
+ *  Like w65c02s_sync_to_cycle, but takes and returns a 64-bit number of
+ *  cycles, even where unsigned long is 32-bit.
+ *
+ *  Only available if the library was compiled with W65C02S_COUNTER_64.
+ *
+ *  [Parameter: cpu] The CPU instance to run
+ *  [Parameter: cycle] The cycle count to run the CPU until
+ *  [Return value] The number of cycles that were run
+ */
+uint64_t w65c02s_sync_to_cycle64(struct w65c02s_cpu *cpu, uint64_t cycle);
+#endif
+
+/** w65c02s_run_shared
+ *
+ *  Runs several CPU instances that share memory for the given number of
+ *  cycles, such as the main CPU and a disk controller or sound CPU.
+ *
+ *  Instead of interleaving the CPUs cycle by cycle, each CPU in turn runs the
+ *  whole slice ahead of the others, until its cycle count is that of the
+ *  first CPU plus cycles. The others only need to be caught up when a
+ *  running CPU accesses memory it shares with them, which is done
+ *  automatically for ranges declared with w65c02s_share_range. As long as
+ *  the CPUs only interact through those ranges, the result is the same as
+ *  running them cycle by cycle, at close to the speed of running them one
+ *  at a time. Larger slices are faster, but interrupts signaled by the host
+ *  between calls are seen later.
+ *
+ *  The cycle counts of the CPUs must be in step, e.g. by initializing them
+ *  together, as they are compared to each other to decide which CPU is
+ *  behind. w65c02s_break does not stop the CPUs early. With W65C02S_COARSE,
+ *  a CPU may end up a few cycles past the end of the slice or the cycle it
+ *  was caught up to.
+ *
+ *  All CPUs must be compiled with the same W65C02S_PREFIX. This function is
+ *  not reentrant for any of the CPUs given.
+ *
+ *  [Parameter: cpus] The CPU instances to run
+ *  [Parameter: count] The number of CPU instances
+ *  [Parameter: cycles] The number of cycles to run
+ *  [Return value] The number of cycles that were actually run by the first
+ *                 CPU
+ */
+unsigned long w65c02s_run_shared(struct w65c02s_cpu *const *cpus,
+                                 size_t count, unsigned long cycles);
+
 /** w65c02s_step_instruction
  *
  *  Runs the CPU for one instruction, or if an instruction is already running,
@@ -202,8 +649,10 @@ unsigned long w65c02s_run_cycles(struct w65c02s_cpu *cpu, unsigned long cycles);
  *  Prefer using w65c02s_run_instructions or w65c02s_run_cycles instead if you
  *  can to run many instructions at once.
  *
- *  This function is not reentrant. Calling it from a callback (for a memory
- *  read, write, STP, etc.) will result in undefined behavior.
+ *  This function is not reentrant for the same CPU. Calling it from a
+ *  callback (for a memory read, write, STP, etc.) of the CPU being run will
+ *  result in undefined behavior, but it may be called on a different CPU
+ *  instance, such as to catch up another CPU that shares memory.
  *
  *  [Parameter: cpu] The CPU instance to run
  *  [Return value] The number of cycles that were actually run
@@ -222,8 +671,10 @@ unsigned long w65c02s_step_instruction(struct w65c02s_cpu *cpu);
  *
  *  Entering an interrupt counts as an instruction here.
  *
- *  This function is not reentrant. Calling it from a callback (for a memory
- *  read, write, STP, etc.) will result in undefined behavior.
+ *  This function is not reentrant for the same CPU. Calling it from a
+ *  callback (for a memory read, write, STP, etc.) of the CPU being run will
+ *  result in undefined behavior, but it may be called on a different CPU
+ *  instance, such as to catch up another CPU that shares memory.
  *
  *  [Parameter: cpu] The CPU instance to run
  *  [Parameter: instructions] The number of instructions to run
@@ -259,6 +710,33 @@ unsigned long w65c02s_get_cycle_count(const struct w65c02s_cpu *cpu);
  */
 unsigned long w65c02s_get_instruction_count(const struct w65c02s_cpu *cpu);
 
+#if W65C02S_COUNTER_64
+/** w65c02s_get_cycle_count64
+ *
+ *  Like w65c02s_get_cycle_count, but returns all 64 bits of the counter,
+ *  even where unsigned long is 32-bit (and w65c02s_get_cycle_count
+ *  returns only the low 32 bits).
+ *
+ *  Only available if the library was compiled with W65C02S_COUNTER_64.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The number of cycles run in total
+ */
+uint64_t w65c02s_get_cycle_count64(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_get_instruction_count64
+ *
+ *  Like w65c02s_get_instruction_count, but returns all 64 bits of the
+ *  counter, even where unsigned long is 32-bit.
+ *
+ *  Only available if the library was compiled with W65C02S_COUNTER_64.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The number of instructions run in total
+ */
+uint64_t w65c02s_get_instruction_count64(const struct w65c02s_cpu *cpu);
+#endif
+
 /** w65c02s_get_cpu_data
  *
  *  Gets the cpu_data pointer associated to the CPU with w65c02s_init.
@@ -342,6 +820,43 @@ void w65c02s_break(struct w65c02s_cpu *cpu);
  */
 void w65c02s_stall(struct w65c02s_cpu *cpu, unsigned long cycles);
 
+/** w65c02s_hold_rdy
+ *
+ *  Holds the RDY line low for the given number of cycles, starting from
+ *  the memory access currently being made. Unlike w65c02s_stall, this
+ *  stalls the CPU in the middle of the instruction, like the real chip.
+ *
+ *  When called from a read callback, the CPU repeats the read of the same
+ *  address on each of the cycles and uses the value of the last one. The
+ *  callback is then called again for every repeated read, and may call
+ *  this function again to change how many cycles are left; calling it with
+ *  0 cycles releases RDY right away. This way, a device can hold the CPU
+ *  until it is done, e.g. for a DMA transfer or slow memory. If
+ *  repeat_reads is false, the reads are not repeated (and the callbacks
+ *  not called) and all of the cycles are simply skipped at once, which is
+ *  much faster if nothing needs to see the repeated reads.
+ *
+ *  When called from a write callback, the write is not repeated and the
+ *  cycles are skipped at once. When called from anywhere else, RDY is held
+ *  from the next memory access on (not counting accesses to pages mapped
+ *  with w65c02s_map_pages, which never stall).
+ *
+ *  In non-coarse mode, if w65c02s_run_cycles runs out of cycles while RDY
+ *  is held, the rest of the cycles are run at the start of the next call
+ *  (with the reads still repeated, but the CPU has already used the value
+ *  of the last read before the end of the previous call). In coarse mode,
+ *  the cycles are always run within the same call.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_RDY.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: cycles] The number of cycles to hold RDY low for
+ *  [Parameter: repeat_reads] Whether to repeat the read on each cycle
+ */
+void w65c02s_hold_rdy(struct w65c02s_cpu *cpu, unsigned long cycles,
+                      bool repeat_reads);
+
 /** w65c02s_nmi
  *
  *  Queues a NMI (non-maskable interrupt) on the CPU.
@@ -376,7 +891,8 @@ void w65c02s_reset(struct w65c02s_cpu *cpu);
  *  If interrupts are enabled on the CPU, the IRQ handler will execute before
  *  the next instruction. Like with NMI, an IRQ on the last cycle will be
  *  delayed until after the next instruction. The IRQ line is held until
- *  w65c02s_irq_cancel is called.
+ *  w65c02s_irq_cancel is called, or for as long as any IRQ source is
+ *  asserted with w65c02s_irq_source.
  *
  *  [Parameter: cpu] The CPU instance
  */
@@ -395,10 +911,58 @@ void w65c02s_irq(struct w65c02s_cpu *cpu);
  *  Generally you would want to hold the IRQ line high and cancel the IRQ
  *  only once it has been acknowledged by the CPU (e.g. through MMIO).
  *
+ *  The IRQ line stays high if any IRQ source is still asserted with
+ *  w65c02s_irq_source.
+ *
  *  [Parameter: cpu] The CPU instance
  */
 void w65c02s_irq_cancel(struct w65c02s_cpu *cpu);
 
+/** w65c02s_irq_source
+ *
+ *  Asserts or deasserts one of several IRQ sources on the CPU, such as the
+ *  IRQ outputs of devices.
+ *
+ *  The sources are wired-OR onto the IRQ line together with w65c02s_irq:
+ *  the line is held high (see w65c02s_irq) while any of them is asserted,
+ *  and pulled low only once all of them have been deasserted. Each device
+ *  can thus assert and deassert its own source whenever its state changes,
+ *  without the host combining the states of all devices. Each call takes
+ *  constant time, regardless of the number of sources.
+ *
+ *  All sources are deasserted after w65c02s_init.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: source] The source, from 0 to W65C02S_IRQ_SOURCES - 1
+ *  [Parameter: asserted] Whether the source asserts IRQ
+ */
+void w65c02s_irq_source(struct w65c02s_cpu *cpu, unsigned source,
+                        bool asserted);
+
+/** w65c02s_irq_get_sources
+ *
+ *  Gets the IRQ sources currently asserted with w65c02s_irq_source.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] A bitmask with bit n set if source n is asserted
+ */
+unsigned long w65c02s_irq_get_sources(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_irq_highest_source
+ *
+ *  Gets the asserted IRQ source with the highest priority, where lower
+ *  numbered sources have higher priority.
+ *
+ *  This works like a priority encoder on boards with vectored IRQs, and can
+ *  be used to implement a register that tells the IRQ handler which device
+ *  to service first.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The asserted source with the lowest number, or -1 if no
+ *                 source is asserted
+ */
+int w65c02s_irq_highest_source(const struct w65c02s_cpu *cpu);
+
 /** w65c02s_set_overflow
  *
  *  Sets the overflow (V) flag on the status register (P) of the CPU.
@@ -418,7 +982,8 @@ void w65c02s_set_overflow(struct w65c02s_cpu *cpu);
  *  returns a non-zero value, the BRK instruction is skipped, and otherwise
  *  it is treated as normal.
  *
- *  Passing NULL as the hook disables the hook.
+ *  Passing NULL as the hook disables the hook. This replaces any hook set
+ *  with w65c02s_hook_brk_cpu.
  *
  *  This function does nothing if the library was not compiled with
  *  W65C02S_HOOK_BRK.
@@ -430,6 +995,26 @@ void w65c02s_set_overflow(struct w65c02s_cpu *cpu);
  */
 bool w65c02s_hook_brk(struct w65c02s_cpu *cpu, bool (*brk_hook)(uint8_t));
 
+/** w65c02s_hook_brk_cpu
+ *
+ *  Hooks the BRK instruction on the CPU, passing the CPU to the hook.
+ *
+ *  Like w65c02s_hook_brk, but the hook function is called with the CPU
+ *  instance before the immediate parameter, so that a host with several
+ *  CPUs can tell them apart (e.g. with w65c02s_get_cpu_data). This replaces
+ *  any hook set with w65c02s_hook_brk.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_HOOK_BRK.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: brk_hook] The new BRK hook
+ *  [Return value] Whether the hook was set (false only if the library
+ *                 was compiled without W65C02S_HOOK_BRK)
+ */
+bool w65c02s_hook_brk_cpu(struct w65c02s_cpu *cpu,
+                          bool (*brk_hook)(struct w65c02s_cpu *, uint8_t));
+
 /** w65c02s_hook_stp
  *
  *  Hooks the STP instruction on the CPU.
@@ -438,7 +1023,8 @@ bool w65c02s_hook_brk(struct w65c02s_cpu *cpu, bool (*brk_hook)(uint8_t));
  *  value, the STP instruction is skipped, and otherwise it is treated
  *  as normal.
  *
- *  Passing NULL as the hook disables the hook.
+ *  Passing NULL as the hook disables the hook. This replaces any hook set
+ *  with w65c02s_hook_stp_cpu.
  *
  *  This function does nothing if the library was not compiled with
  *  W65C02S_HOOK_STP.
@@ -450,6 +1036,24 @@ bool w65c02s_hook_brk(struct w65c02s_cpu *cpu, bool (*brk_hook)(uint8_t));
  */
 bool w65c02s_hook_stp(struct w65c02s_cpu *cpu, bool (*stp_hook)(void));
 
+/** w65c02s_hook_stp_cpu
+ *
+ *  Hooks the STP instruction on the CPU, passing the CPU to the hook.
+ *
+ *  Like w65c02s_hook_stp, but the hook function is called with the CPU
+ *  instance. This replaces any hook set with w65c02s_hook_stp.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_HOOK_STP.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: stp_hook] The new STP hook
+ *  [Return value] Whether the hook was set (0 only if the library
+ *                 was compiled without W65C02S_HOOK_STP)
+ */
+bool w65c02s_hook_stp_cpu(struct w65c02s_cpu *cpu,
+                          bool (*stp_hook)(struct w65c02s_cpu *));
+
 /** w65c02s_hook_end_of_instruction
  *
  *  Hooks the end-of-instruction on the CPU.
@@ -458,7 +1062,8 @@ bool w65c02s_hook_stp(struct w65c02s_cpu *cpu, bool (*stp_hook)(void));
  *  instruction finishes. The interrupt entering routine counts
  *  as an instruction here.
  *
- *  Passing NULL as the hook disables the hook.
+ *  Passing NULL as the hook disables the hook. This replaces any hook set
+ *  with w65c02s_hook_end_of_instruction_cpu.
  *
  *  This function does nothing if the library was not compiled with
  *  W65C02S_HOOK_EOI.
@@ -471,120 +1076,594 @@ bool w65c02s_hook_stp(struct w65c02s_cpu *cpu, bool (*stp_hook)(void));
 bool w65c02s_hook_end_of_instruction(struct w65c02s_cpu *cpu,
                                      void (*instruction_hook)(void));
 
-/** w65c02s_reg_get_a
+/** w65c02s_hook_end_of_instruction_cpu
  *
- *  Returns the value of the A register on the CPU.
+ *  Hooks the end-of-instruction on the CPU, passing the CPU to the hook.
+ *
+ *  Like w65c02s_hook_end_of_instruction, but the hook function is called
+ *  with the CPU instance, and returns whether to stop. If it returns a
+ *  non-zero value, w65c02s_run_cycles or w65c02s_run_instructions returns
+ *  right after this instruction, as if w65c02s_break had been called.
+ *  This replaces any hook set with w65c02s_hook_end_of_instruction.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_HOOK_EOI.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Return value] The value of the A register
+ *  [Parameter: instruction_hook] The new end-of-instruction hook
+ *  [Return value] Whether the hook was set (0 only if the library
+ *                 was compiled without W65C02S_HOOK_EOI)
  */
-uint8_t w65c02s_reg_get_a(const struct w65c02s_cpu *cpu);
+bool w65c02s_hook_end_of_instruction_cpu(struct w65c02s_cpu *cpu,
+                            bool (*instruction_hook)(struct w65c02s_cpu *));
 
-/** w65c02s_reg_get_x
+/** w65c02s_hook_trace
  *
- *  Returns the value of the X register on the CPU.
+ *  Hooks instruction tracing on the CPU.
+ *
+ *  After each instruction, the CPU appends a struct w65c02s_trace_record to
+ *  the given buffer. When the buffer has size records, the hook function is
+ *  called with the CPU instance, the buffer and the number of records in it.
+ *  It must return the buffer to fill next, which must also have room for
+ *  size records. It may return the same buffer once it is done with the
+ *  records, or another one, so that the records can be processed elsewhere
+ *  (such as on another thread) while the CPU keeps running. The interrupt
+ *  entering routine counts as an instruction here.
+ *
+ *  Passing NULL as the hook, or a size of 0, disables tracing. Any records
+ *  still in the buffer are passed to the old hook first.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_HOOK_TRACE.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Return value] The value of the X register
+ *  [Parameter: buffer] The first buffer to fill
+ *  [Parameter: size] The number of records in each buffer, 0 to disable
+ *  [Parameter: trace_hook] The new trace hook
+ *  [Return value] Whether the hook was set (0 only if the library
+ *                 was compiled without W65C02S_HOOK_TRACE)
  */
-uint8_t w65c02s_reg_get_x(const struct w65c02s_cpu *cpu);
+bool w65c02s_hook_trace(struct w65c02s_cpu *cpu,
+                        struct w65c02s_trace_record *buffer, size_t size,
+                        struct w65c02s_trace_record *(*trace_hook)(
+                            struct w65c02s_cpu *,
+                            struct w65c02s_trace_record *, size_t));
 
-/** w65c02s_reg_get_y
+/** w65c02s_flush_trace
  *
- *  Returns the value of the Y register on the CPU.
+ *  Passes the records in the trace buffer to the trace hook right away,
+ *  even if the buffer is not full yet. Does nothing if the buffer is empty.
+ *
+ *  Should not be called from callbacks or hooks.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_HOOK_TRACE.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Return value] The value of the Y register
  */
-uint8_t w65c02s_reg_get_y(const struct w65c02s_cpu *cpu);
+void w65c02s_flush_trace(struct w65c02s_cpu *cpu);
 
-/** w65c02s_reg_get_p
+/** w65c02s_map_pages
  *
- *  Returns the value of the P (processor status) register on the CPU.
+ *  Maps a range of 256-byte memory pages directly to host memory.
+ *
+ *  Reads from page (page + i) are then served from read[i * 256 + offset]
+ *  and writes to it go to write[i * 256 + offset], without calling the
+ *  memory callbacks. Either pointer may be NULL, in which case reads or
+ *  writes to those pages go through the callbacks again; e.g. ROM can be
+ *  mapped with write = NULL, so that the write callback can ignore writes
+ *  to it. The memory must stay valid until the pages are mapped to
+ *  something else.
+ *
+ *  This only updates a table of pages, so switching a window of pages
+ *  between banks costs one call and nothing on later accesses. It can
+ *  be called from callbacks and hooks; the new mapping is used from the
+ *  next memory access on.
+ *
+ *  All pages start out unmapped. The mapping is not part of the state
+ *  saved by w65c02s_save_state.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_PAGE_TABLE.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Return value] The value of the P register
+ *  [Parameter: page] The first page to map (0-255, i.e. address >> 8)
+ *  [Parameter: pages] The number of pages to map; page + pages must be
+ *                     at most 256
+ *  [Parameter: read] The memory to read the pages from, or NULL
+ *  [Parameter: write] The memory to write the pages to, or NULL
+ *  [Return value] Whether the pages were mapped (false if page + pages is
+ *                 above 256 or if the library was compiled without
+ *                 W65C02S_PAGE_TABLE)
  */
-uint8_t w65c02s_reg_get_p(const struct w65c02s_cpu *cpu);
+bool w65c02s_map_pages(struct w65c02s_cpu *cpu, unsigned page, unsigned pages,
+                       const uint8_t *read, uint8_t *write);
 
-/** w65c02s_reg_get_s
+/** w65c02s_set_wait_states
  *
- *  Returns the value of the S (stack pointer) register on the CPU.
+ *  Sets the number of wait states for a range of 256-byte memory pages.
+ *
+ *  Every read or write to those pages, including opcode fetches and
+ *  accesses to pages mapped with w65c02s_map_pages, then takes the given
+ *  number of extra cycles, as if RDY was held low for them without
+ *  repeating the access. The extra cycles are added within the instruction
+ *  without leaving w65c02s_run_cycles, unlike with w65c02s_stall.
+ *
+ *  All pages start out with no wait states. Can be called from callbacks
+ *  and hooks.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_WAIT_STATES.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Return value] The value of the S register
+ *  [Parameter: page] The first page (0-255, i.e. address >> 8)
+ *  [Parameter: pages] The number of pages; page + pages must be at most 256
+ *  [Parameter: cycles] The number of wait states (0-255)
+ *  [Return value] Whether the wait states were set (false if page + pages
+ *                 is above 256 or if the library was compiled without
+ *                 W65C02S_WAIT_STATES)
  */
-uint8_t w65c02s_reg_get_s(const struct w65c02s_cpu *cpu);
+bool w65c02s_set_wait_states(struct w65c02s_cpu *cpu, unsigned page,
+                             unsigned pages, unsigned cycles);
 
-/** w65c02s_reg_get_pc
+/** w65c02s_map_io
  *
- *  Returns the value of the PC (program counter) register on the CPU.
+ *  Gives a range of addresses, such as the registers of a device, its own
+ *  read and write callbacks.
+ *
+ *  Accesses to addresses from start to end (inclusive) then call read or
+ *  write instead of the memory callbacks given to w65c02s_init. Besides
+ *  the address (and the value, for writes), they receive the cycle count
+ *  at the time of the access (see w65c02s_get_cycle_count) and data.
+ *  Either callback may be NULL, in which case reads or writes to the range
+ *  go to the memory callbacks.
+ *
+ *  Ranges may not overlap, and there can be at most W65C02S_IO_REGIONS of
+ *  them. Finding the range of an access takes a table lookup on its page
+ *  and a walk over the (usually very few) ranges within that page, so
+ *  accesses to pages without any ranges cost a single comparison.
+ *
+ *  With W65C02S_PAGE_TABLE, pages mapped with w65c02s_map_pages are
+ *  accessed directly and never reach these callbacks; leave the pages with
+ *  ranges unmapped.
+ *
+ *  Should not be called from the callbacks of a range. No ranges are
+ *  mapped after w65c02s_init.
+ *
+ *  This function does nothing if the library was compiled with
+ *  W65C02S_IO_REGIONS set to 0.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Return value] The value of the PC register
+ *  [Parameter: start] The first address of the range
+ *  [Parameter: end] The last address of the range
+ *  [Parameter: read] The read callback for the range, or NULL
+ *  [Parameter: write] The write callback for the range, or NULL
+ *  [Parameter: data] Passed to the callbacks as is
+ *  [Return value] Whether the range was mapped (false if start > end, if
+ *                 the range overlaps another one, if there are already
+ *                 W65C02S_IO_REGIONS ranges or if W65C02S_IO_REGIONS is 0)
  */
-uint16_t w65c02s_reg_get_pc(const struct w65c02s_cpu *cpu);
-
-/** w65c02s_reg_set_a
+bool w65c02s_map_io(struct w65c02s_cpu *cpu, uint16_t start, uint16_t end,
+                    uint8_t (*read)(struct w65c02s_cpu *, uint16_t,
+                                    unsigned long, void *),
+                    void (*write)(struct w65c02s_cpu *, uint16_t, uint8_t,
+                                  unsigned long, void *),
+                    void *data);
+
+/** w65c02s_unmap_io
  *
- *  Replaces the value of the A register on the CPU.
+ *  Removes a range mapped with w65c02s_map_io.
+ *
+ *  Should not be called from the callbacks of a range.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Parameter: v] The new value of the A register
+ *  [Parameter: address] Any address in the range to remove
+ *  [Return value] Whether a range was removed
  */
-void w65c02s_reg_set_a(struct w65c02s_cpu *cpu, uint8_t v);
+bool w65c02s_unmap_io(struct w65c02s_cpu *cpu, uint16_t address);
 
-/** w65c02s_reg_set_x
+/** w65c02s_share_range
  *
- *  Replaces the value of the X register on the CPU.
+ *  Declares a range of addresses that this CPU shares with another CPU
+ *  instance, such as a mailbox or dual-ported RAM.
+ *
+ *  Before this CPU accesses an address from start to end (inclusive), the
+ *  other CPU is run until its cycle count catches up with that of this CPU
+ *  (see w65c02s_sync_to_cycle), so that the access sees every access the
+ *  other CPU made to the shared memory before it. If the other CPU is
+ *  already ahead or is the one running this CPU, nothing is run. Ranges may
+ *  overlap, so that an address can be shared with several CPUs.
+ *
+ *  Sharing goes one way; to share a range in both directions, also call this
+ *  function on the other CPU. See w65c02s_run_shared for how to run the
+ *  CPUs. Both CPUs must be compiled with the same W65C02S_PREFIX.
+ *
+ *  The check is made before the memory callbacks and pages mapped with
+ *  w65c02s_map_pages, so the shared memory may be mapped. Should not be
+ *  called from callbacks or hooks. No ranges are shared after w65c02s_init.
+ *
+ *  This function does nothing if the library was compiled with
+ *  W65C02S_SHARED set to 0.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Parameter: v] The new value of the X register
+ *  [Parameter: start] The first address of the range
+ *  [Parameter: end] The last address of the range
+ *  [Parameter: other] The CPU instance to share the range with
+ *  [Return value] Whether the range was added (false if start > end, if
+ *                 other is cpu, if there are already W65C02S_SHARED ranges
+ *                 or if W65C02S_SHARED is 0)
  */
-void w65c02s_reg_set_x(struct w65c02s_cpu *cpu, uint8_t v);
+bool w65c02s_share_range(struct w65c02s_cpu *cpu, uint16_t start,
+                         uint16_t end, struct w65c02s_cpu *other);
 
-/** w65c02s_reg_set_y
+/** w65c02s_unshare_ranges
  *
- *  Replaces the value of the Y register on the CPU.
+ *  Removes all ranges shared with another CPU instance by
+ *  w65c02s_share_range.
+ *
+ *  Should not be called from callbacks or hooks.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Parameter: v] The new value of the Y register
+ *  [Parameter: other] The other CPU instance, or NULL to remove all ranges
+ *  [Return value] Whether any range was removed
  */
-void w65c02s_reg_set_y(struct w65c02s_cpu *cpu, uint8_t v);
+bool w65c02s_unshare_ranges(struct w65c02s_cpu *cpu,
+                            struct w65c02s_cpu *other);
 
-/** w65c02s_reg_set_p
+/** w65c02s_fetch_dirty_pages
  *
- *  Replaces the value of the P (processor status) register on the CPU.
+ *  Gets and clears the set of memory pages the CPU has written to.
+ *
+ *  The set is stored in bitmap as 256 bits, one for each 256-byte page:
+ *  page n has been written to since the last call if bit (n & 7) of
+ *  bitmap[n >> 3] is set. All bits are then cleared, so the next call
+ *  only returns pages written after this one. Only writes made by the CPU
+ *  count, whether they went to a page mapped with w65c02s_map_pages or
+ *  through the write callback; memory changed by the host itself does not.
+ *
+ *  Should not be called from callbacks or hooks.
+ *
+ *  If the library was not compiled with W65C02S_DIRTY_PAGES, all bits are
+ *  set, i.e. every page counts as written.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Parameter: v] The new value of the P register
+ *  [Parameter: bitmap] Array of 32 bytes to store the set in
+ *  [Return value] Whether any bit was set
  */
-void w65c02s_reg_set_p(struct w65c02s_cpu *cpu, uint8_t v);
+bool w65c02s_fetch_dirty_pages(struct w65c02s_cpu *cpu, uint8_t *bitmap);
 
-/** w65c02s_reg_set_s
+/** w65c02s_set_heatmap
  *
- *  Replaces the value of the S (stack pointer) register on the CPU.
+ *  Sets the array in which the CPU counts its memory accesses.
+ *
+ *  The array must have 3 * 65536 entries. Each memory access by the CPU
+ *  increments counters[kind * 65536 + address], where kind is
+ *  W65C02S_HEATMAP_FETCH for opcode fetches, W65C02S_HEATMAP_READ for
+ *  all other reads (including operands and spurious reads) and
+ *  W65C02S_HEATMAP_WRITE for writes. The counters are not cleared, so
+ *  the array should be zeroed before it is given to the CPU. The array
+ *  can be saved as is as a binary heatmap, and w65c02s_heatmap_top finds
+ *  the most accessed addresses in it.
+ *
+ *  Accesses skipped by W65C02S_IDLE_LOOP are not counted.
+ *
+ *  Passing NULL stops counting.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_HEATMAP.
  *
  *  [Parameter: cpu] The CPU instance
- *  [Parameter: v] The new value of the S register
+ *  [Parameter: counters] The array of counters, or NULL
+ *  [Return value] Whether the array was set (false only if the library
+ *                 was compiled without W65C02S_HEATMAP)
  */
-void w65c02s_reg_set_s(struct w65c02s_cpu *cpu, uint8_t v);
+bool w65c02s_set_heatmap(struct w65c02s_cpu *cpu, unsigned long *counters);
 
-/** w65c02s_reg_set_pc
+/** w65c02s_heatmap_top
  *
- *  Replaces the value of the PC (program counter) register on the CPU.
+ *  Finds the most accessed addresses of one kind in a heatmap given to
+ *  w65c02s_set_heatmap.
  *
- *  [Parameter: cpu] The CPU instance
- *  [Parameter: v] The new value of the PC register
+ *  The addresses are stored in addresses, most accessed first. Addresses
+ *  with a count of zero are never included.
+ *
+ *  [Parameter: counters] The array of counters
+ *  [Parameter: kind] W65C02S_HEATMAP_READ, W65C02S_HEATMAP_WRITE or
+ *                    W65C02S_HEATMAP_FETCH
+ *  [Parameter: addresses] Array to store the addresses in
+ *  [Parameter: n] The maximum number of addresses to store
+ *  [Return value] The number of addresses stored
  */
-void w65c02s_reg_set_pc(struct w65c02s_cpu *cpu, uint16_t v);
-
-#endif /* W65C02S_H */
+size_t w65c02s_heatmap_top(const unsigned long *counters, unsigned kind,
+                           uint16_t *addresses, size_t n);
 
-#if W65C02S_IMPL
-
-#include <stddef.h>
-#include <limits.h>
+/** w65c02s_disassemble
+ *
+ *  Disassembles one instruction.
+ *
+ *  bytes points to the opcode and must have room for the longest
+ *  instruction (3 bytes). Memory is never read through the CPU, so reading
+ *  I/O registers has no side effects.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_DISASM.
+ *
+ *  [Parameter: insn] The structure to store the instruction in
+ *  [Parameter: address] The address of the opcode
+ *  [Parameter: bytes] The bytes of the instruction
+ *  [Return value] The length of the instruction in bytes (0 only if the
+ *                 library was compiled without W65C02S_DISASM)
+ */
+unsigned w65c02s_disassemble(struct w65c02s_disasm *insn, uint16_t address,
+                             const uint8_t *bytes);
+
+/** w65c02s_disassemble_range
+ *
+ *  Disassembles the instructions in a range of memory one after another.
+ *
+ *  bytes[0] is at address, bytes[1] at address + 1 and so on. Disassembly
+ *  stops after n instructions, or before an instruction that does not fit
+ *  entirely in the size bytes.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_DISASM.
+ *
+ *  [Parameter: insns] Array to store the instructions in
+ *  [Parameter: n] The maximum number of instructions to store
+ *  [Parameter: address] The address of the first byte
+ *  [Parameter: bytes] The bytes to disassemble
+ *  [Parameter: size] The number of bytes
+ *  [Return value] The number of instructions stored
+ */
+size_t w65c02s_disassemble_range(struct w65c02s_disasm *insns, size_t n,
+                                 uint16_t address, const uint8_t *bytes,
+                                 size_t size);
+
+/** w65c02s_disasm_operand
+ *
+ *  Writes the operand of a disassembled instruction as text, such as
+ *  `#$12`, `($1234,X)` or `$12,$34`, in the syntax of the test monitor.
+ *  Branch offsets are written as is, not as targets. The text is empty for
+ *  W65C02S_DISASM_IMPLIED.
+ *
+ *  buf must have room for W65C02S_DISASM_OPERAND_SIZE chars. The text is
+ *  terminated by a null character.
+ *
+ *  [Parameter: insn] The instruction
+ *  [Parameter: buf] The buffer to write the text to
+ *  [Return value] The length of the text
+ */
+size_t w65c02s_disasm_operand(const struct w65c02s_disasm *insn, char *buf);
+
+/** w65c02s_hook_idle_loop
+ *
+ *  Hooks the idle loop detection on the CPU.
+ *
+ *  The CPU looks for loops that jump or branch backwards to the same address
+ *  with the same registers and flags each time, and that only contain
+ *  instructions which do not write to memory or use the stack, and read at
+ *  most one data address (with zero page or absolute addressing, indexed or
+ *  not). Such a loop is typically a busy-wait loop polling an I/O register.
+ *
+ *  When such a loop is found, the hook function is called with the data
+ *  address the loop reads (or, if it reads none, the address of the loop).
+ *  If it returns a non-zero value, the host promises that reading that
+ *  address has no side effects and will keep returning the same value, and
+ *  that neither the reads nor the instruction fetches of the loop need to
+ *  reach the memory callbacks, until the current w65c02s_run_cycles returns.
+ *  The CPU then skips as many whole iterations of the loop as fit in the
+ *  cycles that remain. The cycle and instruction counts stay exact, but the
+ *  memory callbacks and the end-of-instruction hook are not called for the
+ *  skipped iterations. To have the loop end at the right time, the host
+ *  should pass at most the number of cycles until its next scheduled event
+ *  to w65c02s_run_cycles.
+ *
+ *  The hook is called at most once per loop in each call to
+ *  w65c02s_run_cycles, after the CPU has run one whole iteration of the loop
+ *  during that call.
+ *
+ *  Passing NULL as the hook disables the hook, in which case loops
+ *  are never skipped. This replaces any hook set with
+ *  w65c02s_hook_idle_loop_cpu.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_IDLE_LOOP.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: idle_hook] The new idle loop hook
+ *  [Return value] Whether the hook was set (0 only if the library
+ *                 was compiled without W65C02S_IDLE_LOOP)
+ */
+bool w65c02s_hook_idle_loop(struct w65c02s_cpu *cpu,
+                            bool (*idle_hook)(uint16_t address));
+
+/** w65c02s_hook_idle_loop_cpu
+ *
+ *  Hooks the idle loop detection on the CPU, passing the CPU to the hook.
+ *
+ *  Like w65c02s_hook_idle_loop, but the hook function is called with the
+ *  CPU instance before the address. This replaces any hook set with
+ *  w65c02s_hook_idle_loop.
+ *
+ *  This function does nothing if the library was not compiled with
+ *  W65C02S_IDLE_LOOP.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: idle_hook] The new idle loop hook
+ *  [Return value] Whether the hook was set (0 only if the library
+ *                 was compiled without W65C02S_IDLE_LOOP)
+ */
+bool w65c02s_hook_idle_loop_cpu(struct w65c02s_cpu *cpu,
+                    bool (*idle_hook)(struct w65c02s_cpu *, uint16_t address));
+
+/** w65c02s_reg_get_a
+ *
+ *  Returns the value of the A register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The value of the A register
+ */
+uint8_t w65c02s_reg_get_a(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_reg_get_x
+ *
+ *  Returns the value of the X register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The value of the X register
+ */
+uint8_t w65c02s_reg_get_x(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_reg_get_y
+ *
+ *  Returns the value of the Y register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The value of the Y register
+ */
+uint8_t w65c02s_reg_get_y(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_reg_get_p
+ *
+ *  Returns the value of the P (processor status) register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The value of the P register
+ */
+uint8_t w65c02s_reg_get_p(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_reg_get_s
+ *
+ *  Returns the value of the S (stack pointer) register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The value of the S register
+ */
+uint8_t w65c02s_reg_get_s(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_reg_get_pc
+ *
+ *  Returns the value of the PC (program counter) register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Return value] The value of the PC register
+ */
+uint16_t w65c02s_reg_get_pc(const struct w65c02s_cpu *cpu);
+
+/** w65c02s_reg_set_a
+ *
+ *  Replaces the value of the A register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: v] The new value of the A register
+ */
+void w65c02s_reg_set_a(struct w65c02s_cpu *cpu, uint8_t v);
+
+/** w65c02s_reg_set_x
+ *
+ *  Replaces the value of the X register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: v] The new value of the X register
+ */
+void w65c02s_reg_set_x(struct w65c02s_cpu *cpu, uint8_t v);
+
+/** w65c02s_reg_set_y
+ *
+ *  Replaces the value of the Y register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: v] The new value of the Y register
+ */
+void w65c02s_reg_set_y(struct w65c02s_cpu *cpu, uint8_t v);
+
+/** w65c02s_reg_set_p
+ *
+ *  Replaces the value of the P (processor status) register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: v] The new value of the P register
+ */
+void w65c02s_reg_set_p(struct w65c02s_cpu *cpu, uint8_t v);
+
+/** w65c02s_reg_set_s
+ *
+ *  Replaces the value of the S (stack pointer) register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: v] The new value of the S register
+ */
+void w65c02s_reg_set_s(struct w65c02s_cpu *cpu, uint8_t v);
+
+/** w65c02s_reg_set_pc
+ *
+ *  Replaces the value of the PC (program counter) register on the CPU.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: v] The new value of the PC register
+ */
+void w65c02s_reg_set_pc(struct w65c02s_cpu *cpu, uint16_t v);
+
+/** w65c02s_save_state
+ *
+ *  Saves the state of the CPU between instructions.
+ *
+ *  The state contains the registers, cycle and instruction counters, cycles
+ *  still to stall from w65c02s_stall, pending interrupts, and whether the
+ *  CPU is waiting or stopped. It does not contain the memory callbacks,
+ *  hooks or cpu_data, which stay with each CPU instance.
+ *
+ *  Together with w65c02s_load_state, this allows moving a running CPU from
+ *  one core to another, e.g. from a W65C02S_COARSE core to a cycle-exact
+ *  one compiled with a different W65C02S_PREFIX, and back.
+ *
+ *  The state can only be saved at an instruction boundary, and not while
+ *  RDY is held low (see w65c02s_hold_rdy) or wait states are still to be
+ *  taken. Without W65C02S_COARSE, the CPU may have stopped in the middle of
+ *  an instruction or of such a stall, even after the last cycle of an
+ *  instruction; in that case, call w65c02s_step_instruction to finish it
+ *  first.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: state] The structure to save the state into
+ *  [Return value] Whether the state was saved (false only if the CPU
+ *                 is in the middle of an instruction or a stall)
+ */
+bool w65c02s_save_state(const struct w65c02s_cpu *cpu,
+                        struct w65c02s_state *state);
+
+/** w65c02s_load_state
+ *
+ *  Replaces the state of the CPU with one saved by w65c02s_save_state.
+ *
+ *  The CPU must have been initialized with w65c02s_init. Any instruction
+ *  the CPU was in the middle of is abandoned, as is any RDY hold or wait
+ *  states it was still to take. The state may have been saved by a
+ *  differently configured core.
+ *
+ *  [Parameter: cpu] The CPU instance
+ *  [Parameter: state] The state to load
+ */
+void w65c02s_load_state(struct w65c02s_cpu *cpu,
+                        const struct w65c02s_state *state);
+
+#endif /* W65C02S_H_API */
+
+#if W65C02S_IMPL
+
+#include <stddef.h>
+#include <limits.h>
+
+/* the bits of a counter that do not fit in an unsigned long, and back.
+   shifted in two steps, since shifting by the full width is undefined */
+#define W65C02S_ULONG_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define W65C02S_COUNT_HIGH(n)                                                  \
+        ((unsigned long)((n) >> (W65C02S_ULONG_BITS - 1) >> 1))
+#define W65C02S_COUNT_FROM_HIGH(h)                                             \
+        ((W65C02S_COUNT)(h) << (W65C02S_ULONG_BITS - 1) << 1)
+
+/* whether the CPU can be stalled in the middle of an instruction */
+#define W65C02S_STALLS (W65C02S_RDY || W65C02S_WAIT_STATES)
 
 
 
@@ -655,6 +1734,55 @@ struct w65c02s_temp_wai {
     bool is_stp; /* is this STP? */
 };
 
+#if W65C02S_IDLE_LOOP
+/* idle loop detection */
+struct w65c02s_idle_loop {
+    /* total_cycles, total_instructions at the top of the loop */
+    W65C02S_COUNT cycles, instructions;
+    /* cycles and instructions per iteration, if the loop can be skipped */
+    unsigned long skip_cycles, skip_instructions;
+    uint16_t pc; /* top of the loop */
+    uint16_t ipc; /* address of the current instruction */
+    uint16_t last_read; /* last address read */
+    uint16_t address; /* data address read by the loop */
+    uint8_t ir; /* current instruction */
+    uint8_t a, x, y, s, p; /* registers at the top of the loop */
+    bool valid; /* whether the loop is still a candidate */
+    bool has_address; /* whether the loop has read from address */
+    bool asked; /* whether the hook has been asked about this loop */
+    bool approved; /* whether the hook approved this loop */
+};
+#endif
+
+#if W65C02S_HOOK_TRACE
+/* instruction trace buffer */
+struct w65c02s_trace {
+    struct w65c02s_trace_record *buffer;
+    size_t size, count; /* size of the buffer, records in it */
+    uint16_t pc; /* address of the current instruction */
+    uint8_t ir; /* current instruction */
+};
+#endif
+
+
+#if W65C02S_IO_REGIONS
+/* address range with its own callbacks, see w65c02s_map_io */
+struct w65c02s_io_region {
+    uint8_t (*read)(struct w65c02s_cpu *, uint16_t, unsigned long, void *);
+    void (*write)(struct w65c02s_cpu *, uint16_t, uint8_t,
+                  unsigned long, void *);
+    void *data;
+    uint16_t start, end;
+};
+#endif
+
+#if W65C02S_SHARED
+/* address range shared with another CPU, see w65c02s_share_range */
+struct w65c02s_shared_range {
+    struct w65c02s_cpu *other;
+    uint16_t start, end;
+};
+#endif
 
 
 /* +------------------------------------------------------------------------+ */
@@ -667,14 +1795,17 @@ struct w65c02s_temp_wai {
 
 /* please treat w65c02s_cpu as an opaque type */
 struct w65c02s_cpu {
-    unsigned long total_cycles;
+    W65C02S_COUNT total_cycles;
 #if !W65C02S_COARSE
-    unsigned long target_cycles;
+    W65C02S_COUNT target_cycles;
 #endif
     /* run/wait/stop, interrupt trigger flags (see W65C02S_CPU_STATE_)... */
     unsigned cpu_state;
     /* currently active interrupts, interrupt mask */
     unsigned int_trig, int_mask;
+    /* IRQ sources asserted, whether w65c02s_irq holds IRQ */
+    unsigned long irq_sources;
+    bool irq_held;
 
     /* 6502 registers: PC, A, X, Y, S (stack pointer), P (flags). */
     W65C02S_ALIGNAS(2) uint16_t pc;
@@ -704,14 +1835,16 @@ struct w65c02s_cpu {
     unsigned int cycl;
 #endif
 
-    unsigned long total_instructions;
+    W65C02S_COUNT total_instructions;
 
     /* entering NMI, resetting or IRQ? */
     bool in_nmi, in_rst, in_irq;
+    /* inside w65c02s_run_cycles etc.? see w65c02s_sync_to_cycle */
+    bool running;
 
 #if !W65C02S_COARSE
     /* how many cycles we are limited to. changed when w65c02s_break called. */
-    unsigned long maximum_cycles;
+    W65C02S_COUNT maximum_cycles;
 #endif
 
 #if !W65C02S_LINK
@@ -720,13 +1853,77 @@ struct w65c02s_cpu {
     void (*mem_write)(struct w65c02s_cpu *, uint16_t, uint8_t);
 #endif
 
-    /* BRK, STP, end of instruction hooks */
-    bool (*hook_brk)(uint8_t);
-    bool (*hook_stp)(void);
-    void (*hook_eoi)(void);
+    /* BRK, STP, end of instruction, idle loop, trace hooks */
+    bool (*hook_brk)(struct w65c02s_cpu *, uint8_t);
+    bool (*hook_stp)(struct w65c02s_cpu *);
+    bool (*hook_eoi)(struct w65c02s_cpu *);
+    bool (*hook_idle)(struct w65c02s_cpu *, uint16_t);
+    struct w65c02s_trace_record *(*hook_trace)(struct w65c02s_cpu *,
+                                    struct w65c02s_trace_record *, size_t);
+    /* hooks that do not take the CPU, called through the ones above */
+    bool (*hook_brk_plain)(uint8_t);
+    bool (*hook_stp_plain)(void);
+    void (*hook_eoi_plain)(void);
+    bool (*hook_idle_plain)(uint16_t);
+
+#if W65C02S_IDLE_LOOP
+    struct w65c02s_idle_loop idle;
+#endif
+#if W65C02S_HOOK_TRACE
+    struct w65c02s_trace trace;
+#endif
+#if W65C02S_PAGE_TABLE
+    /* host memory for each page, or NULL to use the callbacks */
+    const uint8_t *page_read[256];
+    uint8_t *page_write[256];
+#endif
+#if W65C02S_WAIT_STATES
+    /* wait states for each page, see w65c02s_set_wait_states */
+    uint8_t wait_states[256];
+#endif
+#if W65C02S_IO_REGIONS
+    /* ranges sorted by address, see w65c02s_map_io */
+    struct w65c02s_io_region io[W65C02S_IO_REGIONS];
+    unsigned io_count;
+    /* first range in each page, or W65C02S_IO_REGIONS if none */
+    unsigned short io_page[256];
+#endif
+#if W65C02S_SHARED
+    /* ranges shared with other CPUs, see w65c02s_share_range */
+    struct w65c02s_shared_range shared[W65C02S_SHARED];
+    unsigned shared_count;
+    /* whether any shared range is in each page */
+    bool shared_page[256];
+#endif
+#if W65C02S_DIRTY_PAGES
+    /* bit for each page written to, see w65c02s_fetch_dirty_pages */
+    uint8_t dirty[32];
+#endif
+#if W65C02S_HEATMAP
+    /* access counters, see w65c02s_set_heatmap */
+    unsigned long *heatmap;
+#endif
 
     /* how many cycles we must still stall */
     unsigned long stall_cycles;
+#if W65C02S_STALLS
+    /* how many cycles RDY is still held low, see w65c02s_hold_rdy */
+    unsigned long rdy_cycles;
+#if W65C02S_WAIT_STATES
+    /* wait states still to take after the hold, never repeat the access */
+    unsigned long wait_cycles;
+#endif
+    /* cycles spent with RDY low since the counter was last cleared */
+    W65C02S_COUNT rdy_spent;
+    uint16_t rdy_addr; /* address of the access being held */
+    bool rdy_repeat; /* whether to repeat the read */
+    bool rdy_cont; /* whether the hold continues from the last run call */
+#if !W65C02S_COARSE
+    /* what to redo once a hold that ended a run call is over. the IRQ bit
+       of cpu_state from before the latch, plus W65C02S_RDY_LATCH_* */
+    unsigned rdy_latch;
+#endif
+#endif
 
     /* data pointer from w65c02s_init */
     void *cpu_data;
@@ -840,65 +2037,317 @@ struct w65c02s_cpu {
 #define W65C02S_WRITE(a, v) (*cpu->mem_write)(cpu, a, v)
 #endif
 
-/* used to implement instructions, etc. */
-#if W65C02S_COARSE
-/* increment the total cycle counter. */
-#define W65C02S_CYCLE_TOTAL_INC     ++cpu->total_cycles;
-/* end the instruction immediately. before a read/write! */
-#define W65C02S_SKIP_REST           return cyc
-/* skip to the next cycle n, which should always be the next cycle.
-   must happen before a read/write! */
-#define W65C02S_SKIP_TO_NEXT(n)     goto cycle_##n;
-#define W65C02S_BEGIN_INSTRUCTION   unsigned cyc = 1; (void)oper;
-#define W65C02S_CYCLE_END           ++cyc; W65C02S_CYCLE_TOTAL_INC
-#define W65C02S_CYCLE_LABEL_1(n)    
-#define W65C02S_CYCLE_LABEL_X(n)    goto cycle_##n; cycle_##n:
-#define W65C02S_END_INSTRUCTION     W65C02S_CYCLE_END                          \
-                                W65C02S_SKIP_REST;
-/* skip the rest of the instruction *after* a read/write. */
-#define W65C02S_SKIP_REST_AFTER     do {                                       \
-                                        W65C02S_CYCLE_END;                     \
-                                        return cyc;                            \
-                                    } while (0)
-#define W65C02S_USE_TR(type)        struct w65c02s_temp_##type tmp_;
-#define W65C02S_TR                  tmp_
-#else /* !W65C02S_COARSE */
+#if W65C02S_IO_REGIONS
+/* returns the range containing addr, or NULL if there is none */
+W65C02S_INLINE const struct w65c02s_io_region *w65c02s_io_find(
+                            const struct w65c02s_cpu *cpu, uint16_t addr) {
+    unsigned i = cpu->io_page[addr >> 8];
+    for (; i < cpu->io_count && cpu->io[i].start <= addr; ++i)
+        if (addr <= cpu->io[i].end) return &cpu->io[i];
+    return NULL;
+}
 
-#define W65C02S_CYCLE_CONDITION     ++cpu->total_cycles == cpu->target_cycles
-/* end the instruction immediately. before a read/write! */
-#define W65C02S_SKIP_REST           return 0
-/* skip to the next cycle n, which should always be the next cycle
-   we have to increment cpu->cycl here, otherwise we might continue on the
-   wrong cycle. must happen before a read/write! */
-#define W65C02S_SKIP_TO_NEXT(n)     do { ++cpu->cycl; goto cycle_##n; }        \
-                                                            while (0)
-/* skips must happen before a read/write on that cycle, except for this: */
-/* the skip that takes effect after a read/write. */
-#define W65C02S_SKIP_POST_ACCESS    return 0
-#define W65C02S_BEGIN_INSTRUCTION   if (W65C02S_LIKELY(!cont))                 \
-                                        goto cycle_1;                          \
-                                    (void)oper;                                \
-                                    switch (cpu->cycl) {
-#define W65C02S_CYCLE_END           if (W65C02S_UNLIKELY(                      \
-                                        W65C02S_CYCLE_CONDITION                \
-                                    )) return 1;
-#define W65C02S_CYCLE_END_LAST      cpu->cycl = 0; W65C02S_CYCLE_END
+W65C02S_INLINE uint8_t w65c02s_read_io(struct w65c02s_cpu *cpu,
+                                       uint16_t addr) {
+    const struct w65c02s_io_region *io = w65c02s_io_find(cpu, addr);
+    if (W65C02S_UNLIKELY(io != NULL) && io->read)
+        return (*io->read)(cpu, addr, (unsigned long)cpu->total_cycles,
+                           io->data);
+    return W65C02S_READ(addr);
+}
 
-#define W65C02S_CYCLE_LABEL_1(n)    cycle_##n: case n:
-#define W65C02S_CYCLE_LABEL_X(n)    goto cycle_##n; cycle_##n: case n:
-#define W65C02S_END_INSTRUCTION     W65C02S_CYCLE_END_LAST                     \
-                                    W65C02S_SKIP_REST;                         \
-                                }                                              \
-                                W65C02S_UNREACHABLE();                         \
-                                W65C02S_SKIP_REST;
-/* skip the rest of the instruction *after* a read/write. */
-#define W65C02S_SKIP_REST_AFTER     do {                                       \
-                                        W65C02S_CYCLE_END_LAST;                \
-                                        return 0;                              \
-                                    } while (0)
-#define W65C02S_USE_TR(type)        struct w65c02s_temp_##type * const tmp_ =  \
-                                                &cpu->temp.type;
-#define W65C02S_TR                  (*tmp_)
+W65C02S_INLINE void w65c02s_write_io(struct w65c02s_cpu *cpu,
+                                     uint16_t addr, uint8_t value) {
+    const struct w65c02s_io_region *io = w65c02s_io_find(cpu, addr);
+    if (W65C02S_UNLIKELY(io != NULL) && io->write)
+        (*io->write)(cpu, addr, value, (unsigned long)cpu->total_cycles,
+                       io->data);
+    else
+        W65C02S_WRITE(addr, value);
+}
+#undef W65C02S_READ
+#undef W65C02S_WRITE
+#define W65C02S_READ(a) w65c02s_read_io(cpu, a)
+#define W65C02S_WRITE(a, v) w65c02s_write_io(cpu, a, v)
+#endif
+
+#if W65C02S_STALLS
+#if !W65C02S_COARSE
+/* the cycle of the held access latched interrupts, or decided on WAI.
+   both must see the interrupts from the end of the hold */
+#define W65C02S_RDY_LATCH_IRQ 0x100
+#define W65C02S_RDY_LATCH_WAI 0x200
+#endif
+
+/* holds RDY low for at most limit cycles, returns how many were held.
+   *value is updated with every repeated read */
+static W65C02S_COUNT w65c02s_rdy_run(struct w65c02s_cpu *cpu,
+                                     W65C02S_COUNT limit, uint8_t *value) {
+    W65C02S_COUNT c = 0;
+    while (cpu->rdy_cycles && c < limit) {
+        if (!cpu->rdy_repeat) {
+            /* nothing looks at the repeated reads, skip them all at once */
+            W65C02S_COUNT n = limit - c;
+            if (n > cpu->rdy_cycles) n = cpu->rdy_cycles;
+            cpu->rdy_cycles -= (unsigned long)n;
+            cpu->total_cycles += n;
+            c += n;
+            break;
+        }
+        --cpu->rdy_cycles;
+        ++cpu->total_cycles;
+        ++c;
+        *value = W65C02S_READ(cpu->rdy_addr);
+    }
+#if W65C02S_WAIT_STATES
+    /* wait states come after the hold, however the run is chunked */
+    if (!cpu->rdy_cycles && cpu->wait_cycles && c < limit) {
+        W65C02S_COUNT n = limit - c;
+        if (n > cpu->wait_cycles) n = cpu->wait_cycles;
+        cpu->wait_cycles -= (unsigned long)n;
+        cpu->total_cycles += n;
+        c += n;
+    }
+    cpu->rdy_cont = cpu->rdy_cycles != 0 || cpu->wait_cycles != 0;
+#else
+    cpu->rdy_cont = cpu->rdy_cycles != 0;
+#endif
+    cpu->rdy_spent += c;
+    return c;
+}
+
+/* how many cycles the CPU may be stalled for during the current cycle */
+W65C02S_INLINE W65C02S_COUNT w65c02s_rdy_limit(struct w65c02s_cpu *cpu) {
+#if W65C02S_COARSE
+    (void)cpu;
+    return W65C02S_COUNT_MAX;
+#else
+    /* the current cycle must still end at target_cycles at the latest */
+    return cpu->target_cycles - cpu->total_cycles - 1;
+#endif
+}
+#endif
+
+#if W65C02S_RDY
+static uint8_t w65c02s_rdy_hold(struct w65c02s_cpu *cpu, uint16_t addr,
+                                uint8_t value, bool read) {
+    cpu->rdy_addr = addr;
+    if (!read) cpu->rdy_repeat = false;
+    w65c02s_rdy_run(cpu, w65c02s_rdy_limit(cpu), &value);
+    return value;
+}
+
+W65C02S_INLINE uint8_t w65c02s_read_rdy(struct w65c02s_cpu *cpu,
+                                        uint16_t addr) {
+    uint8_t value = W65C02S_READ(addr);
+    if (W65C02S_UNLIKELY(cpu->rdy_cycles != 0))
+        value = w65c02s_rdy_hold(cpu, addr, value, true);
+    return value;
+}
+
+W65C02S_INLINE void w65c02s_write_rdy(struct w65c02s_cpu *cpu,
+                                      uint16_t addr, uint8_t value) {
+    W65C02S_WRITE(addr, value);
+    if (W65C02S_UNLIKELY(cpu->rdy_cycles != 0))
+        w65c02s_rdy_hold(cpu, addr, value, false);
+}
+#undef W65C02S_READ
+#undef W65C02S_WRITE
+#define W65C02S_READ(a) w65c02s_read_rdy(cpu, a)
+#define W65C02S_WRITE(a, v) w65c02s_write_rdy(cpu, a, v)
+#endif
+
+#if W65C02S_PAGE_TABLE
+/* mapped pages are accessed directly, others through the callbacks */
+W65C02S_INLINE uint8_t w65c02s_read_paged(struct w65c02s_cpu *cpu,
+                                          uint16_t addr) {
+    const uint8_t *page = cpu->page_read[addr >> 8];
+    if (W65C02S_LIKELY(page != NULL)) return page[addr & 0xFF];
+    return W65C02S_READ(addr);
+}
+
+W65C02S_INLINE void w65c02s_write_paged(struct w65c02s_cpu *cpu,
+                                        uint16_t addr, uint8_t value) {
+    uint8_t *page = cpu->page_write[addr >> 8];
+    if (W65C02S_LIKELY(page != NULL))
+        page[addr & 0xFF] = value;
+    else
+        W65C02S_WRITE(addr, value);
+}
+#undef W65C02S_READ
+#undef W65C02S_WRITE
+#define W65C02S_READ(a) w65c02s_read_paged(cpu, a)
+#define W65C02S_WRITE(a, v) w65c02s_write_paged(cpu, a, v)
+#endif
+
+#if W65C02S_WAIT_STATES
+/* stalls the CPU for the wait states of the page of addr. they are kept
+   apart from any RDY hold still left from the access, which may be
+   repeated (and changed by w65c02s_hold_rdy) while they never are */
+static void w65c02s_wait(struct w65c02s_cpu *cpu, uint16_t addr) {
+    uint8_t value;
+    cpu->wait_cycles += cpu->wait_states[addr >> 8];
+    w65c02s_rdy_run(cpu, w65c02s_rdy_limit(cpu), &value);
+}
+
+W65C02S_INLINE uint8_t w65c02s_read_wait(struct w65c02s_cpu *cpu,
+                                         uint16_t addr) {
+    uint8_t value = W65C02S_READ(addr);
+    if (cpu->wait_states[addr >> 8]) w65c02s_wait(cpu, addr);
+    return value;
+}
+
+W65C02S_INLINE void w65c02s_write_wait(struct w65c02s_cpu *cpu,
+                                       uint16_t addr, uint8_t value) {
+    W65C02S_WRITE(addr, value);
+    if (cpu->wait_states[addr >> 8]) w65c02s_wait(cpu, addr);
+}
+#undef W65C02S_READ
+#undef W65C02S_WRITE
+#define W65C02S_READ(a) w65c02s_read_wait(cpu, a)
+#define W65C02S_WRITE(a, v) w65c02s_write_wait(cpu, a, v)
+#endif
+
+#if W65C02S_SHARED
+static W65C02S_COUNT w65c02s_sync(struct w65c02s_cpu *cpu,
+                                  W65C02S_COUNT cycles);
+
+/* catches up the CPUs sharing addr to the cycle count of this one */
+static void w65c02s_share_sync(struct w65c02s_cpu *cpu, uint16_t addr) {
+    unsigned i;
+    for (i = 0; i < cpu->shared_count; ++i) {
+        const struct w65c02s_shared_range *range = &cpu->shared[i];
+        if (range->start <= addr && addr <= range->end) {
+            W65C02S_COUNT behind = cpu->total_cycles
+                                 - range->other->total_cycles;
+            /* a huge difference means the other CPU is ahead */
+            if (behind <= W65C02S_COUNT_MAX / 2)
+                w65c02s_sync(range->other, behind);
+        }
+    }
+}
+
+W65C02S_INLINE uint8_t w65c02s_read_shared(struct w65c02s_cpu *cpu,
+                                           uint16_t addr) {
+    if (W65C02S_UNLIKELY(cpu->shared_page[addr >> 8]))
+        w65c02s_share_sync(cpu, addr);
+    return W65C02S_READ(addr);
+}
+
+W65C02S_INLINE void w65c02s_write_shared(struct w65c02s_cpu *cpu,
+                                         uint16_t addr, uint8_t value) {
+    if (W65C02S_UNLIKELY(cpu->shared_page[addr >> 8]))
+        w65c02s_share_sync(cpu, addr);
+    W65C02S_WRITE(addr, value);
+}
+#undef W65C02S_READ
+#undef W65C02S_WRITE
+#define W65C02S_READ(a) w65c02s_read_shared(cpu, a)
+#define W65C02S_WRITE(a, v) w65c02s_write_shared(cpu, a, v)
+#endif
+
+#if W65C02S_DIRTY_PAGES
+W65C02S_INLINE void w65c02s_write_dirty(struct w65c02s_cpu *cpu,
+                                        uint16_t addr, uint8_t value) {
+    cpu->dirty[addr >> 11] |= 1 << ((addr >> 8) & 7);
+    W65C02S_WRITE(addr, value);
+}
+#undef W65C02S_WRITE
+#define W65C02S_WRITE(a, v) w65c02s_write_dirty(cpu, a, v)
+#endif
+
+#if W65C02S_IDLE_LOOP
+/* the last address read is the data address of the instruction, if any */
+W65C02S_INLINE uint8_t w65c02s_read_noted(struct w65c02s_cpu *cpu,
+                                          uint16_t addr) {
+    cpu->idle.last_read = addr;
+    return W65C02S_READ(addr);
+}
+#undef W65C02S_READ
+#define W65C02S_READ(a) w65c02s_read_noted(cpu, a)
+#endif
+
+#if W65C02S_HEATMAP
+W65C02S_INLINE uint8_t w65c02s_read_counted(struct w65c02s_cpu *cpu,
+                                            uint16_t addr, unsigned kind) {
+    if (cpu->heatmap) ++cpu->heatmap[kind * 0x10000UL + addr];
+    return W65C02S_READ(addr);
+}
+
+W65C02S_INLINE void w65c02s_write_counted(struct w65c02s_cpu *cpu,
+                                          uint16_t addr, uint8_t value) {
+    if (cpu->heatmap) ++cpu->heatmap[W65C02S_HEATMAP_WRITE * 0x10000UL + addr];
+    W65C02S_WRITE(addr, value);
+}
+#undef W65C02S_READ
+#undef W65C02S_WRITE
+#define W65C02S_READ(a) w65c02s_read_counted(cpu, a, W65C02S_HEATMAP_READ)
+#define W65C02S_WRITE(a, v) w65c02s_write_counted(cpu, a, v)
+/* opcode fetch */
+#define W65C02S_FETCH(a) w65c02s_read_counted(cpu, a, W65C02S_HEATMAP_FETCH)
+#else
+#define W65C02S_FETCH(a) W65C02S_READ(a)
+#endif
+
+/* used to implement instructions, etc. */
+#if W65C02S_COARSE
+/* increment the total cycle counter. */
+#define W65C02S_CYCLE_TOTAL_INC     ++cpu->total_cycles;
+/* end the instruction immediately. before a read/write! */
+#define W65C02S_SKIP_REST           return cyc
+/* skip to the next cycle n, which should always be the next cycle.
+   must happen before a read/write! */
+#define W65C02S_SKIP_TO_NEXT(n)     goto cycle_##n;
+#define W65C02S_BEGIN_INSTRUCTION   unsigned cyc = 1; (void)oper;
+#define W65C02S_CYCLE_END           ++cyc; W65C02S_CYCLE_TOTAL_INC
+#define W65C02S_CYCLE_LABEL_1(n)    
+#define W65C02S_CYCLE_LABEL_X(n)    goto cycle_##n; cycle_##n:
+#define W65C02S_END_INSTRUCTION     W65C02S_CYCLE_END                          \
+                                W65C02S_SKIP_REST;
+/* skip the rest of the instruction *after* a read/write. */
+#define W65C02S_SKIP_REST_AFTER     do {                                       \
+                                        W65C02S_CYCLE_END;                     \
+                                        return cyc;                            \
+                                    } while (0)
+#define W65C02S_USE_TR(type)        struct w65c02s_temp_##type tmp_;
+#define W65C02S_TR                  tmp_
+#else /* !W65C02S_COARSE */
+
+#define W65C02S_CYCLE_CONDITION     ++cpu->total_cycles == cpu->target_cycles
+/* end the instruction immediately. before a read/write! */
+#define W65C02S_SKIP_REST           return 0
+/* skip to the next cycle n, which should always be the next cycle
+   we have to increment cpu->cycl here, otherwise we might continue on the
+   wrong cycle. must happen before a read/write! */
+#define W65C02S_SKIP_TO_NEXT(n)     do { ++cpu->cycl; goto cycle_##n; }        \
+                                                            while (0)
+/* skips must happen before a read/write on that cycle, except for this: */
+/* the skip that takes effect after a read/write. */
+#define W65C02S_SKIP_POST_ACCESS    return 0
+#define W65C02S_BEGIN_INSTRUCTION   if (W65C02S_LIKELY(!cont))                 \
+                                        goto cycle_1;                          \
+                                    (void)oper;                                \
+                                    switch (cpu->cycl) {
+#define W65C02S_CYCLE_END           if (W65C02S_UNLIKELY(                      \
+                                        W65C02S_CYCLE_CONDITION                \
+                                    )) return 1;
+#define W65C02S_CYCLE_END_LAST      cpu->cycl = 0; W65C02S_CYCLE_END
+
+#define W65C02S_CYCLE_LABEL_1(n)    cycle_##n: case n:
+#define W65C02S_CYCLE_LABEL_X(n)    goto cycle_##n; cycle_##n: case n:
+#define W65C02S_END_INSTRUCTION     W65C02S_CYCLE_END_LAST                     \
+                                    W65C02S_SKIP_REST;                         \
+                                }                                              \
+                                W65C02S_UNREACHABLE();                         \
+                                W65C02S_SKIP_REST;
+/* skip the rest of the instruction *after* a read/write. */
+#define W65C02S_SKIP_REST_AFTER     do {                                       \
+                                        W65C02S_CYCLE_END_LAST;                \
+                                        return 0;                              \
+                                    } while (0)
+#define W65C02S_USE_TR(type)        struct w65c02s_temp_##type * const tmp_ =  \
+                                                &cpu->temp.type;
+#define W65C02S_TR                  (*tmp_)
 #endif
 
 #define W65C02S_CYCLE_1                           W65C02S_CYCLE_LABEL_1(1)
@@ -1238,6 +2687,47 @@ static uint8_t w65c02s_oper_sbc_d(struct w65c02s_cpu *cpu,
     return (uint8_t)q;
 }
 
+#if W65C02S_DECIMAL_TABLE
+/* decimal mode results indexed by c << 16 | a << 8 | b (b flipped for SBC).
+   the low byte is the result, the high byte is p_adj. */
+static uint16_t w65c02s_adc_d_table[0x20000UL];
+static uint16_t w65c02s_sbc_d_table[0x20000UL];
+
+static void w65c02s_fill_decimal_tables(void) {
+    struct w65c02s_cpu tmp;
+    unsigned long i;
+    tmp.p = 0;
+    for (i = 0; i < 0x20000UL; ++i) {
+        uint8_t a = (uint8_t)(i >> 8), b = (uint8_t)i;
+        unsigned c = (unsigned)(i >> 16);
+        uint8_t q;
+        q = w65c02s_oper_adc_d(&tmp, a, b, c);
+        w65c02s_adc_d_table[i] = (uint16_t)(q | (tmp.p_adj << 8));
+        q = w65c02s_oper_sbc_d(&tmp, a, b, c);
+        w65c02s_sbc_d_table[i] = (uint16_t)(q | (tmp.p_adj << 8));
+    }
+}
+
+/* decimal mode ADC/SBC with a table lookup */
+W65C02S_INLINE uint8_t w65c02s_oper_d_table(struct w65c02s_cpu *cpu,
+                                            const uint16_t *table,
+                                            uint8_t a, uint8_t b, unsigned c) {
+    unsigned r = table[((unsigned long)c << 16) | ((unsigned)a << 8) | b];
+    uint8_t p_adj = (uint8_t)(r >> 8);
+    W65C02S_SET_P(cpu->p, W65C02S_P_C, p_adj & W65C02S_P_C);
+    cpu->p_adj = p_adj;
+    return (uint8_t)r;
+}
+
+#define W65C02S_OPER_ADC_D(cpu, a, b, c)                                       \
+            w65c02s_oper_d_table(cpu, w65c02s_adc_d_table, a, b, c)
+#define W65C02S_OPER_SBC_D(cpu, a, b, c)                                       \
+            w65c02s_oper_d_table(cpu, w65c02s_sbc_d_table, a, b, c)
+#else
+#define W65C02S_OPER_ADC_D(cpu, a, b, c) w65c02s_oper_adc_d(cpu, a, b, c)
+#define W65C02S_OPER_SBC_D(cpu, a, b, c) w65c02s_oper_sbc_d(cpu, a, b, c)
+#endif
+
 /* ADC a, b = a + b + c (except in BCD mode). updates N, Z, V, C. */
 W65C02S_INLINE uint8_t w65c02s_oper_adc(struct w65c02s_cpu *cpu,
                                         uint8_t a, uint8_t b) {
@@ -1247,7 +2737,7 @@ W65C02S_INLINE uint8_t w65c02s_oper_adc(struct w65c02s_cpu *cpu,
     cpu->p = W65C02S_SET_P(p, W65C02S_P_V, w65c02s_oper_adc_v(a, b, c));
     r = w65c02s_mark_nzc8(cpu, a + b + c); /* update N, Z, C */
     if (!W65C02S_GET_P(p, W65C02S_P_D)) return r;
-    return w65c02s_oper_adc_d(cpu, a, b, c); /* use decimal mode instead */
+    return W65C02S_OPER_ADC_D(cpu, a, b, c); /* use decimal mode instead */
 }
 
 /* SBC a, b = a + ~b + c (except in BCD mode). updates N, Z, V, C. */
@@ -1260,7 +2750,7 @@ W65C02S_INLINE uint8_t w65c02s_oper_sbc(struct w65c02s_cpu *cpu,
     cpu->p = W65C02S_SET_P(p, W65C02S_P_V, w65c02s_oper_adc_v(a, b, c));
     r = w65c02s_mark_nzc8(cpu, a + b + c); /* update N, Z, C */
     if (!W65C02S_GET_P(p, W65C02S_P_D)) return r;
-    return w65c02s_oper_sbc_d(cpu, a, b, c); /* use decimal mode instead */
+    return W65C02S_OPER_SBC_D(cpu, a, b, c); /* use decimal mode instead */
 }
 
 /* CMP a, b = a - b, but update only flags N, Z, C. */
@@ -1376,6 +2866,12 @@ W65C02S_INLINE void w65c02s_irq_update_mask(struct w65c02s_cpu *cpu) {
    on 2-cycle ops, it happens after fetching the opcode.
    on 1-cycle NOPs, it does not happen at all! */
 W65C02S_INLINE void w65c02s_irq_latch(struct w65c02s_cpu *cpu) {
+#if W65C02S_STALLS && !W65C02S_COARSE
+    /* the held access ended the last run call, see w65c02s_rdy_resume */
+    if (W65C02S_UNLIKELY(cpu->rdy_cont))
+        cpu->rdy_latch = W65C02S_RDY_LATCH_IRQ
+                       | (cpu->cpu_state & W65C02S_CPU_STATE_IRQ);
+#endif
     cpu->cpu_state |= cpu->int_trig & cpu->int_mask;
 }
 
@@ -1383,6 +2879,10 @@ W65C02S_INLINE void w65c02s_irq_latch(struct w65c02s_cpu *cpu) {
 W65C02S_INLINE void w65c02s_irq_latch_slow(struct w65c02s_cpu *cpu) {
     cpu->cpu_state = (cpu->cpu_state & ~W65C02S_CPU_STATE_IRQ)
                    | (cpu->int_trig & cpu->int_mask);
+#if W65C02S_STALLS && !W65C02S_COARSE
+    if (W65C02S_UNLIKELY(cpu->rdy_cont))
+        cpu->rdy_latch = W65C02S_RDY_LATCH_IRQ;
+#endif
 }
 
 /* selects an interrupt vector. used by BRK. */
@@ -1956,10 +3456,11 @@ W65C02S_INLINE unsigned w65c02s_mode_RELATIVE(W65C02S_PARAMS_MODE) {
             /* copy PC to old_pc and compute new_pc with offset */
             W65C02S_TR.new_pc = w65c02s_compute_branch(
                         W65C02S_TR.old_pc = cpu->pc, offset);
+            /* end the instruction here if branch is not taken */
+            if (!w65c02s_oper_branch(oper, cpu->p))
+                W65C02S_SKIP_REST_AFTER;
         }
         W65C02S_CYCLE(2)
-            /* skip the rest of the instruction if branch is not taken */
-            if (!w65c02s_oper_branch(oper, cpu->p)) W65C02S_SKIP_REST;
             /* skip one read cycle if no page boundary crossed */
             if (W65C02S_GET_HI(cpu->pc = W65C02S_TR.new_pc)
                        == W65C02S_GET_HI(W65C02S_TR.old_pc))
@@ -1988,11 +3489,11 @@ static unsigned w65c02s_mode_RELATIVE_BIT(W65C02S_PARAMS_MODE) {
             W65C02S_TR.new_pc = w65c02s_compute_branch(
                         W65C02S_TR.old_pc = cpu->pc, offset);
             w65c02s_irq_latch(cpu);
+            /* end the instruction here if branch is not taken */
+            if (!w65c02s_oper_bitbranch(oper, W65C02S_TR.data))
+                W65C02S_SKIP_REST_AFTER;
         }
         W65C02S_CYCLE(5)
-            /* skip the rest of the instruction if branch is not taken */
-            if (!w65c02s_oper_bitbranch(oper, W65C02S_TR.data))
-                W65C02S_SKIP_REST;
             /* skip one read cycle if no page boundary crossed */
             if (W65C02S_GET_HI(cpu->pc = W65C02S_TR.new_pc)
                        == W65C02S_GET_HI(W65C02S_TR.old_pc))
@@ -2241,7 +3742,8 @@ W65C02S_INLINE unsigned w65c02s_mode_STACK_BRK(W65C02S_PARAMS_MODE) {
             if (W65C02S_TR.is_brk) {
                 ++cpu->pc;
 #if W65C02S_HOOK_BRK
-                if (cpu->hook_brk && (*cpu->hook_brk)(tmp)) W65C02S_SKIP_REST;
+                if (cpu->hook_brk && (*cpu->hook_brk)(cpu, tmp))
+                    W65C02S_SKIP_REST;
 #else
                 (void)tmp;
 #endif
@@ -2280,14 +3782,8 @@ W65C02S_INLINE unsigned w65c02s_mode_STACK_BRK(W65C02S_PARAMS_MODE) {
             w65c02s_irq_latch(cpu);
         W65C02S_CYCLE(6)
             W65C02S_SET_HI(cpu->pc, W65C02S_READ(W65C02S_TR.ea));
-        W65C02S_CYCLE(7)
-            /* end instantly! this is a "ghost" cycle in a way. */
             /* HW interrupts do not increment the instruction counter */
             if (!W65C02S_TR.is_brk) --cpu->total_instructions;
-#if !W65C02S_COARSE
-            cpu->cycl = 0;
-#endif
-            W65C02S_SKIP_REST;
     W65C02S_END_INSTRUCTION
 }
 
@@ -2322,7 +3818,7 @@ W65C02S_INLINE unsigned w65c02s_mode_INT_WAIT_STOP(W65C02S_PARAMS_MODE) {
             /* STP (1) or WAI (0) */
             W65C02S_TR.is_stp = oper != W65C02S_OPER_WAI;
 #if W65C02S_HOOK_STP
-            if (W65C02S_TR.is_stp && cpu->hook_stp && (*cpu->hook_stp)())
+            if (W65C02S_TR.is_stp && cpu->hook_stp && (*cpu->hook_stp)(cpu))
                 W65C02S_SKIP_REST;
 #endif
         W65C02S_CYCLE(2)
@@ -2332,6 +3828,11 @@ W65C02S_INLINE unsigned w65c02s_mode_INT_WAIT_STOP(W65C02S_PARAMS_MODE) {
             if (W65C02S_TR.is_stp) {
                 W65C02S_CPU_STATE_INSERT(cpu->cpu_state,
                                          W65C02S_CPU_STATE_STOP);
+#if W65C02S_STALLS && !W65C02S_COARSE
+            } else if (W65C02S_UNLIKELY(cpu->rdy_cont)) {
+                /* decide once the hold ends, see w65c02s_rdy_resume */
+                cpu->rdy_latch = W65C02S_RDY_LATCH_WAI;
+#endif
             /* don't enter WAI if *any* interrupts are lined up */
             } else if (W65C02S_CPU_STATE_EXTRACT_WITH_INTS(cpu->cpu_state)
                         == W65C02S_CPU_STATE_RUN && !cpu->int_trig) {
@@ -2626,7 +4127,9 @@ W65C02S_OPCODE(0xFF, RELATIVE_BIT,              017)              /* 017 rlb */
 
 
 #if !W65C02S_COARSE
-static void w65c02s_prerun_mode(struct w65c02s_cpu *cpu, uint8_t ir) {
+/* called when stopping right after decoding an instruction.
+   returns whether the instruction has already ended (1-cycle NOPs) */
+static bool w65c02s_prerun_mode(struct w65c02s_cpu *cpu, uint8_t ir) {
     unsigned mode;
 
     switch (ir) {
@@ -2646,7 +4149,11 @@ W65C02S_OPCODE_TABLE()
     case W65C02S_MODE_IMMEDIATE:
     case W65C02S_MODE_RELATIVE:
         w65c02s_irq_latch(cpu);
+        break;
+    case W65C02S_MODE_IMPLIED_1C:
+        return true;
     }
+    return false;
 }
 #endif
 
@@ -2716,11 +4223,175 @@ W65C02S_INLINE bool w65c02s_handle_interrupt(struct w65c02s_cpu *cpu) {
     return true;
 }
 
+#if W65C02S_IDLE_LOOP
+#define W65C02S_IDLE_LOOP_NO_DATA 0
+#define W65C02S_IDLE_LOOP_DATA 1
+#define W65C02S_IDLE_LOOP_NO 2
+
+/* whether an instruction may be in an idle loop, and if so,
+   whether its last read is of its data address. */
+static unsigned w65c02s_idle_loop_kind(uint8_t ir) {
+    unsigned mode, oper;
+
+    switch (ir) {
+        default: W65C02S_UNREACHABLE();
+#define W65C02S_OPCODE(opcode, o_mode, o_oper)                                 \
+        case opcode: mode = W65C02S_MODE_ ## o_mode; oper = o_oper; break;
+W65C02S_OPCODE_TABLE()
+#undef W65C02S_OPCODE
+    }
+
+    switch (mode) {
+    case W65C02S_MODE_IMPLIED:
+    case W65C02S_MODE_IMPLIED_X:
+    case W65C02S_MODE_IMPLIED_Y:
+    case W65C02S_MODE_IMPLIED_1C:
+    case W65C02S_MODE_IMMEDIATE:
+    case W65C02S_MODE_RELATIVE:
+    case W65C02S_MODE_ABSOLUTE_JUMP:
+        return W65C02S_IDLE_LOOP_NO_DATA;
+    case W65C02S_MODE_ZEROPAGE:
+    case W65C02S_MODE_ZEROPAGE_X:
+    case W65C02S_MODE_ZEROPAGE_Y:
+    case W65C02S_MODE_ABSOLUTE:
+    case W65C02S_MODE_ABSOLUTE_X:
+    case W65C02S_MODE_ABSOLUTE_Y:
+        /* stores write, everything else only reads */
+        return oper < W65C02S_OPER_STA ? W65C02S_IDLE_LOOP_DATA
+                                       : W65C02S_IDLE_LOOP_NO;
+    }
+    return W65C02S_IDLE_LOOP_NO;
+}
+
+/* called at the end of every instruction. if the CPU has just arrived at the
+   top of an approved idle loop, sets idle.skip_cycles. */
+static void w65c02s_idle_loop_track(struct w65c02s_cpu *cpu) {
+    struct w65c02s_idle_loop *loop = &cpu->idle;
+    loop->skip_cycles = 0;
+    if (!cpu->hook_idle) return;
+
+    switch (w65c02s_idle_loop_kind(loop->ir)) {
+    case W65C02S_IDLE_LOOP_DATA:
+        if (loop->has_address && loop->address != loop->last_read)
+            loop->valid = false;
+        loop->address = loop->last_read;
+        loop->has_address = true;
+        break;
+    case W65C02S_IDLE_LOOP_NO:
+        loop->valid = false;
+        return;
+    }
+
+    /* only check at backward jumps and branches (or jumps to self) */
+    if (cpu->pc > loop->ipc) return;
+
+    if (loop->valid && loop->pc == cpu->pc
+            && cpu->cpu_state == W65C02S_CPU_STATE_RUN
+            && loop->a == cpu->a && loop->x == cpu->x && loop->y == cpu->y
+            && loop->s == cpu->s && loop->p == cpu->p) {
+        /* same state as on the last iteration, so the next one will
+           be exactly the same if the data read is the same. */
+        if (!loop->asked) {
+            loop->asked = true;
+            loop->approved = (cpu->hook_idle)(cpu, loop->has_address
+                                                ? loop->address : loop->pc);
+        }
+        if (loop->approved) {
+            loop->skip_cycles = (unsigned long)
+                                (cpu->total_cycles - loop->cycles);
+            loop->skip_instructions = (unsigned long)
+                                (cpu->total_instructions - loop->instructions);
+        }
+    } else {
+        /* new candidate */
+        loop->pc = cpu->pc;
+        loop->asked = false;
+    }
+
+    loop->valid = true;
+    loop->has_address = false;
+    loop->cycles = cpu->total_cycles;
+    loop->instructions = cpu->total_instructions;
+    loop->a = cpu->a;
+    loop->x = cpu->x;
+    loop->y = cpu->y;
+    loop->s = cpu->s;
+    loop->p = cpu->p;
+}
+
+/* skip as many iterations of an approved idle loop as fit in the given
+   number of cycles. returns the number of cycles skipped. */
+static W65C02S_COUNT w65c02s_idle_loop_skip(struct w65c02s_cpu *cpu,
+                                            W65C02S_COUNT cycles) {
+    struct w65c02s_idle_loop *loop = &cpu->idle;
+    W65C02S_COUNT n = cycles / loop->skip_cycles;
+    W65C02S_COUNT skipped = n * loop->skip_cycles;
+    cpu->total_cycles += skipped;
+    cpu->total_instructions += n * loop->skip_instructions;
+    loop->cycles += skipped;
+    loop->instructions += n * loop->skip_instructions;
+    loop->skip_cycles = 0;
+    return skipped;
+}
+
+#define W65C02S_IDLE_LOOP_DECODED(ir_) \
+    (cpu->idle.ir = (ir_), cpu->idle.ipc = cpu->pc - 1)
+#else
+#define W65C02S_IDLE_LOOP_DECODED(ir_)
+#endif
+
+#if W65C02S_HOOK_TRACE
+W65C02S_INLINE void w65c02s_trace_decoded(struct w65c02s_cpu *cpu,
+                                          uint8_t ir) {
+    cpu->trace.ir = ir;
+    /* interrupts run as a BRK that was never fetched, PC was not advanced */
+    if (!ir && (cpu->in_nmi || cpu->in_irq || cpu->in_rst))
+        cpu->trace.pc = cpu->pc;
+    else
+        cpu->trace.pc = cpu->pc - 1;
+}
+
+static void w65c02s_trace_flush(struct w65c02s_cpu *cpu) {
+    if (cpu->trace.count) {
+        cpu->trace.buffer = (cpu->hook_trace)(cpu, cpu->trace.buffer,
+                                              cpu->trace.count);
+        cpu->trace.count = 0;
+    }
+}
+
+W65C02S_INLINE void w65c02s_trace_add(struct w65c02s_cpu *cpu) {
+    struct w65c02s_trace_record *rec = &cpu->trace.buffer[cpu->trace.count];
+    rec->cycles = cpu->total_cycles;
+    rec->pc = cpu->trace.pc;
+    rec->ir = cpu->trace.ir;
+    rec->a = cpu->a;
+    rec->x = cpu->x;
+    rec->y = cpu->y;
+    rec->s = cpu->s;
+    rec->p = cpu->p | W65C02S_P_A1 | W65C02S_P_B;
+    if (++cpu->trace.count == cpu->trace.size) w65c02s_trace_flush(cpu);
+}
+#define W65C02S_TRACE_DECODED(ir_) w65c02s_trace_decoded(cpu, ir_)
+#else
+#define W65C02S_TRACE_DECODED(ir_)
+#endif
+
+/* called after an opcode has been fetched (or an interrupt started) */
+#define W65C02S_DECODED(ir_)                                                   \
+    W65C02S_IDLE_LOOP_DECODED(ir_);                                            \
+    W65C02S_TRACE_DECODED(ir_)
+
 W65C02S_INLINE void w65c02s_handle_end_of_instruction(struct w65c02s_cpu *cpu) {
     /* increment instruction tally */
     ++cpu->total_instructions;
+#if W65C02S_IDLE_LOOP
+    w65c02s_idle_loop_track(cpu);
+#endif
+#if W65C02S_HOOK_TRACE
+    if (cpu->hook_trace) w65c02s_trace_add(cpu);
+#endif
 #if W65C02S_HOOK_EOI
-    if (cpu->hook_eoi) (cpu->hook_eoi)();
+    if (cpu->hook_eoi && (cpu->hook_eoi)(cpu)) w65c02s_break(cpu);
 #endif
 }
 
@@ -2733,6 +4404,22 @@ static bool w65c02s_handle_break(struct w65c02s_cpu *cpu) {
     return W65C02S_CPU_STATE_HAS_BREAK(cpu);
 }
 
+#if W65C02S_IDLE_SKIP
+/* whether the CPU is waiting or stopped, and nothing will wake it up or
+   break out of execution before the host does something. */
+W65C02S_INLINE bool w65c02s_is_idle(struct w65c02s_cpu *cpu) {
+    if (W65C02S_CPU_STATE_HAS_BREAK(cpu) || W65C02S_CPU_STATE_HAS_RESET(cpu))
+        return false;
+    switch (W65C02S_CPU_STATE_EXTRACT(cpu->cpu_state)) {
+        case W65C02S_CPU_STATE_WAIT:
+            return !cpu->int_trig;
+        case W65C02S_CPU_STATE_STOP:
+            return true;
+    }
+    return false;
+}
+#endif
+
 static bool w65c02s_handle_stp_wai_i(struct w65c02s_cpu *cpu) {
     switch (W65C02S_CPU_STATE_EXTRACT(cpu->cpu_state)) {
         case W65C02S_CPU_STATE_WAIT:
@@ -2745,8 +4432,10 @@ static bool w65c02s_handle_stp_wai_i(struct w65c02s_cpu *cpu) {
         case W65C02S_CPU_STATE_STOP:
             if (W65C02S_CPU_STATE_HAS_RESET(cpu))
                 return false;
+#if !W65C02S_IDLE_SKIP
             /* spurious read to waste a cycle */
             W65C02S_READ(cpu->pc); /* stall for a cycle */
+#endif
             W65C02S_SPENT_CYCLE;
             return true;
     }
@@ -2756,6 +4445,13 @@ static bool w65c02s_handle_stp_wai_i(struct w65c02s_cpu *cpu) {
 #if !W65C02S_COARSE
 
 static bool w65c02s_handle_stp_wai_c(struct w65c02s_cpu *cpu) {
+#if W65C02S_IDLE_SKIP
+    if (w65c02s_is_idle(cpu)) {
+        /* nothing can happen until the host intervenes, use up all cycles */
+        cpu->total_cycles = cpu->target_cycles;
+        return true;
+    }
+#endif
     switch (W65C02S_CPU_STATE_EXTRACT(cpu->cpu_state)) {
         case W65C02S_CPU_STATE_WAIT:
             for (;;) {
@@ -2771,6 +4467,10 @@ static bool w65c02s_handle_stp_wai_c(struct w65c02s_cpu *cpu) {
                 }
                 W65C02S_READ(cpu->pc); /* stall for a cycle */
                 if (W65C02S_CYCLE_CONDITION) return true;
+                /* woken up during the read, the IRQ may be gone again */
+                if (W65C02S_CPU_STATE_EXTRACT(cpu->cpu_state)
+                        != W65C02S_CPU_STATE_WAIT)
+                    return false;
             }
         case W65C02S_CPU_STATE_STOP:
             for (;;) {
@@ -2785,17 +4485,28 @@ static bool w65c02s_handle_stp_wai_c(struct w65c02s_cpu *cpu) {
     return false;
 }
 
-static unsigned long w65c02s_execute_c(struct w65c02s_cpu *cpu,
-                                       unsigned long maximum_cycles) {
+static W65C02S_COUNT w65c02s_execute_c(struct w65c02s_cpu *cpu,
+                                       W65C02S_COUNT maximum_cycles) {
     uint8_t ir;
     cpu->maximum_cycles = maximum_cycles;
     cpu->target_cycles = cpu->total_cycles + maximum_cycles;
     if (cpu->cycl) {
         /* continue running instruction */
         ir = cpu->ir;
+#if W65C02S_STALLS
+        cpu->rdy_spent = 0;
+#endif
         if (w65c02s_run_op(cpu, ir, W65C02S_CONTINUE_INSTRUCTION)) {
             maximum_cycles = cpu->maximum_cycles;
-            if (cpu->cycl) cpu->cycl += maximum_cycles;
+            if (cpu->cycl)
+#if W65C02S_STALLS
+                /* cycles with RDY held low did not advance the instruction */
+                cpu->cycl += maximum_cycles - cpu->rdy_spent;
+#else
+                cpu->cycl += maximum_cycles;
+#endif
+            else /* finished on the very last cycle */
+                w65c02s_handle_end_of_instruction(cpu);
             return maximum_cycles;
         }
         goto end_of_instruction;
@@ -2808,15 +4519,23 @@ static unsigned long w65c02s_execute_c(struct w65c02s_cpu *cpu,
     }
 
     for (;;) {
-        unsigned long cyclecount;
-        ir = W65C02S_READ(cpu->pc++);
+        W65C02S_COUNT cyclecount;
+        ir = W65C02S_FETCH(cpu->pc++);
 
 decoded:
-        cpu->cycl = 0;
+        W65C02S_DECODED(ir);
+        /* cycl stays non-zero until the last cycle of the instruction */
+        cpu->cycl = 1;
         cyclecount = cpu->total_cycles;
+#if W65C02S_STALLS
+        cpu->rdy_spent = 0;
+#endif
         if (W65C02S_UNLIKELY(W65C02S_CYCLE_CONDITION)) {
-            cpu->cycl = 1; /* stopped after decoding, continue from there */
-            w65c02s_prerun_mode(cpu, ir);
+            /* stopped after decoding, continue from there */
+            if (w65c02s_prerun_mode(cpu, ir)) {
+                cpu->cycl = 0;
+                w65c02s_handle_end_of_instruction(cpu);
+            }
             cpu->ir = ir;
             return cpu->maximum_cycles;
         }
@@ -2824,7 +4543,12 @@ decoded:
         if (W65C02S_UNLIKELY(w65c02s_run_op(cpu, ir,
                              W65C02S_STARTING_INSTRUCTION))) {
             if (cpu->cycl) {
-                cpu->cycl += cpu->total_cycles - cyclecount;
+                /* the decoding cycle does not count, cycl started at 1 */
+                cpu->cycl += cpu->total_cycles - cyclecount - 1;
+#if W65C02S_STALLS
+                /* nor do cycles with RDY held low */
+                cpu->cycl -= cpu->rdy_spent;
+#endif
                 cpu->ir = ir;
             } else {
                 w65c02s_handle_end_of_instruction(cpu);
@@ -2836,6 +4560,12 @@ decoded:
     (cpu->maximum_cycles - (cpu->target_cycles - cpu->total_cycles))
 end_of_instruction:
         w65c02s_handle_end_of_instruction(cpu);
+#if W65C02S_IDLE_LOOP
+        /* leave at least one cycle, we must still stop at target_cycles */
+        if (W65C02S_UNLIKELY(cpu->idle.skip_cycles))
+            w65c02s_idle_loop_skip(cpu,
+                                cpu->target_cycles - cpu->total_cycles - 1);
+#endif
         if (W65C02S_UNLIKELY(cpu->cpu_state != W65C02S_CPU_STATE_RUN)) {
 check_special_state:
             if (w65c02s_handle_break(cpu) || w65c02s_handle_stp_wai_c(cpu)) {
@@ -2879,8 +4609,9 @@ static unsigned long w65c02s_execute_i(struct w65c02s_cpu *cpu) {
         }
     }
 
-    ir = W65C02S_READ(cpu->pc++);
+    ir = W65C02S_FETCH(cpu->pc++);
 decoded:
+    W65C02S_DECODED(ir);
     W65C02S_SPENT_CYCLE;
 
 #if !W65C02S_COARSE
@@ -2896,15 +4627,125 @@ decoded:
 
 #if W65C02S_COARSE
 
-static unsigned long w65c02s_execute_ix(struct w65c02s_cpu *cpu,
-                                        unsigned long cycles) {
-    unsigned long c = 0;
+#if W65C02S_FUSION
+/* fused pairs: first opcode, its mode and oper, and the opcode, mode and
+   oper of the instruction that is expected to follow it */
+#define W65C02S_FUSION_TABLE()                                                 \
+W65C02S_FUSE(0x18, IMPLIED,             W65C02S_OPER_CLC,  /* CLC imp */       \
+             0x69, IMMEDIATE,           W65C02S_OPER_ADC)  /* ADC imm */       \
+W65C02S_FUSE(0x38, IMPLIED,             W65C02S_OPER_SEC,  /* SEC imp */       \
+             0xE9, IMMEDIATE,           W65C02S_OPER_SBC)  /* SBC imm */       \
+W65C02S_FUSE(0x88, IMPLIED_Y,           W65C02S_OPER_DEC,  /* DEC imy */       \
+             0xD0, RELATIVE,            W65C02S_OPER_BNE)  /* BNE rel */       \
+W65C02S_FUSE(0xA5, ZEROPAGE,            W65C02S_OPER_LDA,  /* LDA zpg */       \
+             0x85, ZEROPAGE,            W65C02S_OPER_STA)  /* STA zpg */       \
+W65C02S_FUSE(0xA9, IMMEDIATE,           W65C02S_OPER_LDA,  /* LDA imm */       \
+             0x85, ZEROPAGE,            W65C02S_OPER_STA)  /* STA zpg */       \
+W65C02S_FUSE(0xAD, ABSOLUTE,            W65C02S_OPER_LDA,  /* LDA abs */       \
+             0x8D, ABSOLUTE,            W65C02S_OPER_STA)  /* STA abs */       \
+W65C02S_FUSE(0xB1, ZEROPAGE_INDIRECT_Y, W65C02S_OPER_LDA,  /* LDA ziy */       \
+             0x91, ZEROPAGE_INDIRECT_Y_STORE, W65C02S_OPER_STA) /* STA ziy */  \
+W65C02S_FUSE(0xB9, ABSOLUTE_Y,          W65C02S_OPER_LDA,  /* LDA aby */       \
+             0x99, ABSOLUTE_Y_STORE,    W65C02S_OPER_STA)  /* STA aby */       \
+W65C02S_FUSE(0xBD, ABSOLUTE_X,          W65C02S_OPER_LDA,  /* LDA abx */       \
+             0x9D, ABSOLUTE_X_STORE,    W65C02S_OPER_STA)  /* STA abx */       \
+W65C02S_FUSE(0xC8, IMPLIED_Y,           W65C02S_OPER_INC,  /* INC imy */       \
+             0xD0, RELATIVE,            W65C02S_OPER_BNE)  /* BNE rel */       \
+W65C02S_FUSE(0xCA, IMPLIED_X,           W65C02S_OPER_DEC,  /* DEC imx */       \
+             0xD0, RELATIVE,            W65C02S_OPER_BNE)  /* BNE rel */       \
+W65C02S_FUSE(0xE8, IMPLIED_X,           W65C02S_OPER_INC,  /* INC imx */       \
+             0xD0, RELATIVE,            W65C02S_OPER_BNE)  /* BNE rel */
+
+/* whether the next instruction can be run right away, i.e. whether
+   w65c02s_execute_ix would just call w65c02s_execute_i again */
+W65C02S_INLINE bool w65c02s_fusion_ok(struct w65c02s_cpu *cpu) {
+#if W65C02S_IDLE_LOOP
+    if (cpu->idle.skip_cycles) return false;
+#endif
+    return cpu->cpu_state == W65C02S_CPU_STATE_RUN;
+}
+
+#if W65C02S_STALLS
+/* cycles with RDY held low also use up the cycles left */
+#define W65C02S_FUSION_SPENT(c) ((c) + cpu->rdy_spent)
+#else
+#define W65C02S_FUSION_SPENT(c) (c)
+#endif
+
+/* like w65c02s_execute_i, but if the instruction starts a fused pair and
+   there are cycles left, also runs the next instruction. if that is the
+   expected one, it is run without going through w65c02s_run_op.
+   the bus traffic is exactly the same as with w65c02s_execute_i. */
+static unsigned long w65c02s_execute_if(struct w65c02s_cpu *cpu,
+                                        W65C02S_COUNT cycles) {
+    unsigned long c;
+    uint8_t ir;
+
+    if (W65C02S_UNLIKELY(cpu->cpu_state != W65C02S_CPU_STATE_RUN))
+        return w65c02s_execute_i(cpu);
+
+    ir = W65C02S_FETCH(cpu->pc++);
+    W65C02S_DECODED(ir);
+    W65C02S_SPENT_CYCLE;
+
+    switch (ir) {
+#define W65C02S_FUSE(op1, mode1, oper1, op2, mode2, oper2)                     \
+        case op1:                                                              \
+            c = w65c02s_mode_##mode1(cpu, oper1);                              \
+            w65c02s_handle_end_of_instruction(cpu);                            \
+            if (W65C02S_FUSION_SPENT(c) >= cycles                              \
+                    || !w65c02s_fusion_ok(cpu))                                \
+                return c;                                                      \
+            ir = W65C02S_FETCH(cpu->pc++);                                     \
+            W65C02S_DECODED(ir);                                               \
+            W65C02S_SPENT_CYCLE;                                               \
+            if (W65C02S_LIKELY(ir == op2))                                     \
+                c += w65c02s_mode_##mode2(cpu, oper2);                         \
+            else                                                               \
+                c += w65c02s_run_op(cpu, ir);                                  \
+            break;
+W65C02S_FUSION_TABLE()
+#undef W65C02S_FUSE
+        default:
+            c = w65c02s_run_op(cpu, ir);
+    }
+    w65c02s_handle_end_of_instruction(cpu);
+    return c;
+}
+#endif /* W65C02S_FUSION */
+
+static W65C02S_COUNT w65c02s_execute_ix(struct w65c02s_cpu *cpu,
+                                        W65C02S_COUNT cycles) {
+    W65C02S_COUNT c = 0;
     /* we may overflow otherwise */
-    if (cycles > ULONG_MAX - 8) cycles = ULONG_MAX - 8;
+    if (cycles > W65C02S_COUNT_MAX - 8) cycles = W65C02S_COUNT_MAX - 8;
+#if W65C02S_STALLS
+    cpu->rdy_spent = 0;
+#endif
     while (c < cycles) {
-        unsigned ic = w65c02s_execute_i(cpu);
+        unsigned ic;
+#if W65C02S_IDLE_SKIP
+        if (W65C02S_UNLIKELY(w65c02s_is_idle(cpu))) {
+            cpu->total_cycles += cycles - c;
+            return cycles;
+        }
+#endif
+#if W65C02S_FUSION
+        ic = w65c02s_execute_if(cpu, cycles - c);
+#else
+        ic = w65c02s_execute_i(cpu);
+#endif
         if (W65C02S_UNLIKELY(!ic)) break; /* w65c02s_break() */
         c += ic;
+#if W65C02S_STALLS
+        /* ic does not include cycles with RDY held low */
+        c += cpu->rdy_spent;
+        cpu->rdy_spent = 0;
+#endif
+#if W65C02S_IDLE_LOOP
+        if (W65C02S_UNLIKELY(cpu->idle.skip_cycles) && c < cycles)
+            c += w65c02s_idle_loop_skip(cpu, cycles - c);
+#endif
     }
     return c;
 }
@@ -2920,6 +4761,40 @@ static unsigned long w65c02s_execute_im(struct w65c02s_cpu *cpu,
     return c;
 }
 
+#if W65C02S_STALLS
+/* continues holding RDY low after w65c02s_run_cycles ran out of cycles.
+   the cycle of the held access has already ended, so the first repeated
+   read happens on the current cycle */
+static W65C02S_COUNT w65c02s_rdy_resume(struct w65c02s_cpu *cpu,
+                                        W65C02S_COUNT limit) {
+    W65C02S_COUNT c;
+    uint8_t value;
+    --cpu->total_cycles;
+    c = w65c02s_rdy_run(cpu, limit, &value);
+    ++cpu->total_cycles;
+#if !W65C02S_COARSE
+    /* the held cycle sees the interrupts from its very end, after any
+       signaled while it was held */
+    if (!cpu->rdy_cont && cpu->rdy_latch) {
+        if (cpu->rdy_latch & W65C02S_RDY_LATCH_IRQ)
+            cpu->cpu_state = (cpu->cpu_state & ~W65C02S_CPU_STATE_IRQ)
+                           | (cpu->rdy_latch & W65C02S_CPU_STATE_IRQ)
+                           | (cpu->int_trig & cpu->int_mask);
+        else if (W65C02S_CPU_STATE_EXTRACT_WITH_INTS(cpu->cpu_state)
+                    == W65C02S_CPU_STATE_RUN && !cpu->int_trig)
+            W65C02S_CPU_STATE_INSERT(cpu->cpu_state, W65C02S_CPU_STATE_WAIT);
+        cpu->rdy_latch = 0;
+    }
+#endif
+    return c;
+}
+
+static void w65c02s_rdy_finish(struct w65c02s_cpu *cpu) {
+    if (W65C02S_UNLIKELY(cpu->rdy_cont))
+        w65c02s_rdy_resume(cpu, W65C02S_COUNT_MAX);
+}
+#endif
+
 
 
 /* +------------------------------------------------------------------------+ */
@@ -2934,6 +4809,12 @@ size_t w65c02s_cpu_size(void) {
     return sizeof(struct w65c02s_cpu);
 }
 
+void w65c02s_init_decimal_tables(void) {
+#if W65C02S_DECIMAL_TABLE
+    w65c02s_fill_decimal_tables();
+#endif
+}
+
 #if !W65C02S_LINK
 static uint8_t w65c02s_openbus_read(struct w65c02s_cpu *cpu,
                                     uint16_t addr) {
@@ -2944,6 +4825,34 @@ static void w65c02s_openbus_write(struct w65c02s_cpu *cpu,
                                   uint16_t addr, uint8_t value) { }
 #endif
 
+#if W65C02S_IO_REGIONS
+/* recomputes the first range in each page after the ranges changed */
+static void w65c02s_io_update(struct w65c02s_cpu *cpu) {
+    unsigned page, i = 0;
+    for (page = 0; page < 256; ++page) {
+        /* ranges are sorted and do not overlap, so neither do their ends */
+        while (i < cpu->io_count && (unsigned)(cpu->io[i].end >> 8) < page)
+            ++i;
+        cpu->io_page[page] = (unsigned short)
+                    (i < cpu->io_count && (unsigned)(cpu->io[i].start >> 8)
+                        <= page ? i : W65C02S_IO_REGIONS);
+    }
+}
+#endif
+
+#if W65C02S_SHARED
+/* recomputes which pages have shared ranges after the ranges changed */
+static void w65c02s_share_update(struct w65c02s_cpu *cpu) {
+    unsigned page, i;
+    for (page = 0; page < 256; ++page)
+        cpu->shared_page[page] = false;
+    for (i = 0; i < cpu->shared_count; ++i)
+        for (page = cpu->shared[i].start >> 8;
+                page <= (unsigned)(cpu->shared[i].end >> 8); ++page)
+            cpu->shared_page[page] = true;
+}
+#endif
+
 void w65c02s_init(struct w65c02s_cpu *cpu,
                   uint8_t (*mem_read)(struct w65c02s_cpu *, uint16_t),
                   void (*mem_write)(struct w65c02s_cpu *, uint16_t, uint8_t),
@@ -2953,6 +4862,8 @@ void w65c02s_init(struct w65c02s_cpu *cpu,
     cpu->cycl = 0;
 #endif
     cpu->int_trig = 0;
+    cpu->irq_sources = 0;
+    cpu->irq_held = false;
     cpu->in_nmi = cpu->in_rst = cpu->in_irq = 0;
 
 #if !W65C02S_LINK
@@ -2965,21 +4876,64 @@ void w65c02s_init(struct w65c02s_cpu *cpu,
     cpu->hook_brk = NULL;
     cpu->hook_stp = NULL;
     cpu->hook_eoi = NULL;
+    cpu->hook_idle = NULL;
+    cpu->hook_trace = NULL;
     cpu->cpu_data = cpu_data;
+#if W65C02S_IDLE_LOOP
+    cpu->idle.valid = false;
+    cpu->idle.skip_cycles = 0;
+#endif
+#if W65C02S_HOOK_TRACE
+    cpu->trace.count = 0;
+#endif
+#if W65C02S_PAGE_TABLE
+    w65c02s_map_pages(cpu, 0, 256, NULL, NULL);
+#endif
+#if W65C02S_WAIT_STATES
+    w65c02s_set_wait_states(cpu, 0, 256, 0);
+#endif
+#if W65C02S_IO_REGIONS
+    cpu->io_count = 0;
+    w65c02s_io_update(cpu);
+#endif
+#if W65C02S_SHARED
+    cpu->shared_count = 0;
+    w65c02s_share_update(cpu);
+#endif
+#if W65C02S_HEATMAP
+    cpu->heatmap = NULL;
+#endif
+#if W65C02S_DIRTY_PAGES
+    {
+        unsigned i;
+        for (i = 0; i < 32; ++i) cpu->dirty[i] = 0;
+    }
+#endif
 
     cpu->pc = 0xFFFFU;
     cpu->a = cpu->x = cpu->y = cpu->s = cpu->p = 0xFF;
     cpu->cpu_state = W65C02S_CPU_STATE_RESET;
     cpu->stall_cycles = 0;
+    cpu->running = false;
+#if W65C02S_STALLS
+    cpu->rdy_cycles = cpu->rdy_spent = 0;
+    cpu->rdy_repeat = cpu->rdy_cont = false;
+#if !W65C02S_COARSE
+    cpu->rdy_latch = 0;
+#endif
+#if W65C02S_WAIT_STATES
+    cpu->wait_cycles = 0;
+#endif
+#endif
 }
 
-unsigned long w65c02s_run_cycles(struct w65c02s_cpu *cpu,
-                                 unsigned long cycles) {
-    unsigned long c = 0;
+static W65C02S_COUNT w65c02s_run(struct w65c02s_cpu *cpu,
+                                 W65C02S_COUNT cycles) {
+    W65C02S_COUNT c = 0;
     if (W65C02S_UNLIKELY(cpu->stall_cycles)) {
         if (cpu->stall_cycles > cycles) {
             cpu->total_cycles += cycles;
-            cpu->stall_cycles -= cycles;
+            cpu->stall_cycles -= (unsigned long)cycles;
             return cycles;
         } else {
             cpu->total_cycles += cpu->stall_cycles;
@@ -2988,17 +4942,108 @@ unsigned long w65c02s_run_cycles(struct w65c02s_cpu *cpu,
         }
     }
     if (W65C02S_UNLIKELY(!cycles)) return 0;
+#if W65C02S_STALLS
+    if (W65C02S_UNLIKELY(cpu->rdy_cont)) {
+        /* RDY was still held low when the last call ran out of cycles */
+        c = w65c02s_rdy_resume(cpu, cycles);
+        cycles -= c;
+        if (!cycles) return c;
+    }
+#endif
     W65C02S_CPU_STATE_RST_FLAG(cpu, W65C02S_CPU_STATE_BREAK);
+#if W65C02S_IDLE_LOOP
+    /* the host may have changed anything, look at a whole new iteration */
+    cpu->idle.valid = false;
+#endif
 #if W65C02S_COARSE
-    c = w65c02s_execute_ix(cpu, cycles);
+    c += w65c02s_execute_ix(cpu, cycles);
 #else
-    c = w65c02s_execute_c(cpu, cycles);
+    c += w65c02s_execute_c(cpu, cycles);
+#endif
+    return c;
+}
+
+unsigned long w65c02s_run_cycles(struct w65c02s_cpu *cpu,
+                                 unsigned long cycles) {
+    W65C02S_COUNT c;
+#if W65C02S_COARSE
+    /* we may run a few cycles more than asked, and must be able to
+       return that many */
+    if (cycles > ULONG_MAX - 8) cycles = ULONG_MAX - 8;
 #endif
+    cpu->running = true;
+    c = w65c02s_run(cpu, cycles);
+    cpu->running = false;
+    return (unsigned long)c;
+}
+
+#if W65C02S_COUNTER_64
+uint64_t w65c02s_run_cycles64(struct w65c02s_cpu *cpu, uint64_t cycles) {
+    uint64_t c;
+    cpu->running = true;
+    c = w65c02s_run(cpu, cycles);
+    cpu->running = false;
     return c;
 }
+#endif
+
+/* runs the CPU until its cycle count is cycles higher than now, even if
+   w65c02s_break is called */
+static W65C02S_COUNT w65c02s_sync(struct w65c02s_cpu *cpu,
+                                  W65C02S_COUNT cycles) {
+    W65C02S_COUNT c = 0;
+    /* the CPU is further up the call stack, it cannot be run from here */
+    if (cpu->running) return 0;
+    cpu->running = true;
+    while (c < cycles) {
+        W65C02S_COUNT n = w65c02s_run(cpu, cycles - c);
+        if (!n) break;
+        c += n;
+    }
+    cpu->running = false;
+    return c;
+}
+
+unsigned long w65c02s_sync_to_cycle(struct w65c02s_cpu *cpu,
+                                    unsigned long cycle) {
+    unsigned long behind = cycle - (unsigned long)cpu->total_cycles;
+    /* a huge difference means the CPU is already past the cycle */
+    if (behind > ULONG_MAX / 2) return 0;
+    return (unsigned long)w65c02s_sync(cpu, behind);
+}
+
+#if W65C02S_COUNTER_64
+uint64_t w65c02s_sync_to_cycle64(struct w65c02s_cpu *cpu, uint64_t cycle) {
+    uint64_t behind = cycle - cpu->total_cycles;
+    if (behind > (uint64_t)-1 / 2) return 0;
+    return w65c02s_sync(cpu, behind);
+}
+#endif
+
+unsigned long w65c02s_run_shared(struct w65c02s_cpu *const *cpus,
+                                 size_t count, unsigned long cycles) {
+    W65C02S_COUNT start, target;
+    size_t i;
+    if (W65C02S_UNLIKELY(!count)) return 0;
+    start = cpus[0]->total_cycles;
+    target = start + cycles;
+    /* every CPU runs the whole slice; shared accesses catch the others up */
+    for (i = 0; i < count; ++i) {
+        W65C02S_COUNT behind = target - cpus[i]->total_cycles;
+        if (behind <= W65C02S_COUNT_MAX / 2) w65c02s_sync(cpus[i], behind);
+    }
+    return (unsigned long)(cpus[0]->total_cycles - start);
+}
 
 unsigned long w65c02s_step_instruction(struct w65c02s_cpu *cpu) {
-    unsigned cycles;
+    unsigned long cycles;
+#if W65C02S_STALLS
+    W65C02S_COUNT start = cpu->total_cycles;
+#endif
+    cpu->running = true;
+#if W65C02S_STALLS
+    w65c02s_rdy_finish(cpu);
+#endif
     W65C02S_CPU_STATE_RST_FLAG(cpu, W65C02S_CPU_STATE_BREAK);
 #if !W65C02S_COARSE
     if (W65C02S_UNLIKELY(cpu->cycl))
@@ -3009,6 +5054,11 @@ unsigned long w65c02s_step_instruction(struct w65c02s_cpu *cpu) {
 #if !W65C02S_COARSE
     cpu->cycl = 0;
 #endif
+#if W65C02S_STALLS
+    /* cycles does not include those with RDY held low */
+    cycles = (unsigned long)(cpu->total_cycles - start);
+#endif
+    cpu->running = false;
     return cycles;
 }
 
@@ -3016,7 +5066,14 @@ unsigned long w65c02s_run_instructions(struct w65c02s_cpu *cpu,
                                        unsigned long instructions,
                                        bool finish_existing) {
     unsigned long total_cycles, stalled = 0;
+#if W65C02S_STALLS
+    W65C02S_COUNT start = cpu->total_cycles;
+#endif
     if (W65C02S_UNLIKELY(!instructions)) return 0;
+    cpu->running = true;
+#if W65C02S_STALLS
+    w65c02s_rdy_finish(cpu);
+#endif
     W65C02S_CPU_STATE_RST_FLAG(cpu, W65C02S_CPU_STATE_BREAK);
     if (W65C02S_UNLIKELY(cpu->stall_cycles)) {
         stalled = cpu->stall_cycles;
@@ -3026,9 +5083,9 @@ unsigned long w65c02s_run_instructions(struct w65c02s_cpu *cpu,
 #if !W65C02S_COARSE
     if (W65C02S_UNLIKELY(cpu->cycl)) {
         total_cycles = w65c02s_execute_ic(cpu);
-        if (!finish_existing && !--instructions)
-            return total_cycles;
-        total_cycles += w65c02s_execute_im(cpu, instructions);
+        /* the current instruction may count towards the limit */
+        if (finish_existing || --instructions)
+            total_cycles += w65c02s_execute_im(cpu, instructions);
     } else
         total_cycles = w65c02s_execute_im(cpu, instructions);
 #else
@@ -3038,13 +5095,21 @@ unsigned long w65c02s_run_instructions(struct w65c02s_cpu *cpu,
 #if !W65C02S_COARSE
     cpu->cycl = 0;
 #endif
+    cpu->running = false;
+#if W65C02S_STALLS
+    /* total_cycles does not include cycles with RDY held low */
+    (void)total_cycles;
+    (void)stalled;
+    return (unsigned long)(cpu->total_cycles - start);
+#else
     return total_cycles + stalled;
+#endif
 }
 
 void w65c02s_break(struct w65c02s_cpu *cpu) {
 #if !W65C02S_COARSE
     /* also adjust the cycle counters so we stop right away. */
-    unsigned long next_cycle = cpu->total_cycles + 1;
+    W65C02S_COUNT next_cycle = cpu->total_cycles + 1;
     cpu->maximum_cycles -= cpu->target_cycles - next_cycle;
     cpu->target_cycles = next_cycle;
 #endif
@@ -3056,6 +5121,18 @@ void w65c02s_stall(struct w65c02s_cpu *cpu, unsigned long cycles) {
     cpu->stall_cycles += cycles;
 }
 
+void w65c02s_hold_rdy(struct w65c02s_cpu *cpu, unsigned long cycles,
+                      bool repeat_reads) {
+#if W65C02S_RDY
+    cpu->rdy_cycles = cycles;
+    cpu->rdy_repeat = repeat_reads;
+#else
+    (void)cpu;
+    (void)cycles;
+    (void)repeat_reads;
+#endif
+}
+
 void w65c02s_nmi(struct w65c02s_cpu *cpu) {
     cpu->int_trig |= W65C02S_CPU_STATE_NMI;
     if (W65C02S_CPU_STATE_EXTRACT(cpu->cpu_state) == W65C02S_CPU_STATE_WAIT) {
@@ -3070,7 +5147,12 @@ void w65c02s_reset(struct w65c02s_cpu *cpu) {
     W65C02S_CPU_STATE_CLEAR_NMI(cpu);
 }
 
-void w65c02s_irq(struct w65c02s_cpu *cpu) {
+/* the IRQ line is wired-OR of w65c02s_irq and the IRQ sources */
+static void w65c02s_irq_line(struct w65c02s_cpu *cpu) {
+    if (!cpu->irq_held && !cpu->irq_sources) {
+        cpu->int_trig &= ~W65C02S_CPU_STATE_IRQ;
+        return;
+    }
     cpu->int_trig |= W65C02S_CPU_STATE_IRQ;
     if (W65C02S_CPU_STATE_EXTRACT(cpu->cpu_state) == W65C02S_CPU_STATE_WAIT) {
         W65C02S_CPU_STATE_INSERT(cpu->cpu_state, W65C02S_CPU_STATE_RUN);
@@ -3078,12 +5160,94 @@ void w65c02s_irq(struct w65c02s_cpu *cpu) {
     }
 }
 
+void w65c02s_irq(struct w65c02s_cpu *cpu) {
+    cpu->irq_held = true;
+    w65c02s_irq_line(cpu);
+}
+
 void w65c02s_irq_cancel(struct w65c02s_cpu *cpu) {
-    cpu->int_trig &= ~W65C02S_CPU_STATE_IRQ;
+    cpu->irq_held = false;
+    w65c02s_irq_line(cpu);
+}
+
+void w65c02s_irq_source(struct w65c02s_cpu *cpu, unsigned source,
+                        bool asserted) {
+    unsigned long bit;
+    if (source >= W65C02S_IRQ_SOURCES) return;
+    bit = 1UL << source;
+    if (asserted) {
+        /* the line only changes with the first source */
+        bool low = !cpu->irq_held && !cpu->irq_sources;
+        cpu->irq_sources |= bit;
+        if (low) w65c02s_irq_line(cpu);
+    } else if (cpu->irq_sources & bit) {
+        cpu->irq_sources &= ~bit;
+        if (!cpu->irq_sources) w65c02s_irq_line(cpu);
+    }
+}
+
+unsigned long w65c02s_irq_get_sources(const struct w65c02s_cpu *cpu) {
+    return cpu->irq_sources;
 }
 
+int w65c02s_irq_highest_source(const struct w65c02s_cpu *cpu) {
+    unsigned long sources = cpu->irq_sources;
+    int source = 0;
+    if (!sources) return -1;
+#if W65C02S_GNUC
+    source = __builtin_ctzl(sources);
+#else
+    /* find the lowest set bit by halving (sources fit in 32 bits) */
+    if (!(sources & 0xFFFFUL)) source += 16, sources >>= 16;
+    if (!(sources & 0xFFUL)) source += 8, sources >>= 8;
+    if (!(sources & 0xFUL)) source += 4, sources >>= 4;
+    if (!(sources & 0x3UL)) source += 2, sources >>= 2;
+    if (!(sources & 0x1UL)) source += 1;
+#endif
+    return source;
+}
+
+/* the hooks that do not take the CPU are called through these */
+#if W65C02S_HOOK_BRK
+static bool w65c02s_call_brk_plain(struct w65c02s_cpu *cpu, uint8_t imm) {
+    return (*cpu->hook_brk_plain)(imm);
+}
+#endif
+
+#if W65C02S_HOOK_STP
+static bool w65c02s_call_stp_plain(struct w65c02s_cpu *cpu) {
+    return (*cpu->hook_stp_plain)();
+}
+#endif
+
+#if W65C02S_HOOK_EOI
+static bool w65c02s_call_eoi_plain(struct w65c02s_cpu *cpu) {
+    (*cpu->hook_eoi_plain)();
+    return false;
+}
+#endif
+
+#if W65C02S_IDLE_LOOP
+static bool w65c02s_call_idle_plain(struct w65c02s_cpu *cpu, uint16_t addr) {
+    return (*cpu->hook_idle_plain)(addr);
+}
+#endif
+
 /* brk_hook: 0 = treat BRK as normal, <>0 = treat it as NOP */
 bool w65c02s_hook_brk(struct w65c02s_cpu *cpu, bool (*brk_hook)(uint8_t)) {
+#if W65C02S_HOOK_BRK
+    cpu->hook_brk_plain = brk_hook;
+    cpu->hook_brk = brk_hook ? &w65c02s_call_brk_plain : NULL;
+    return true;
+#else
+    (void)cpu;
+    (void)brk_hook;
+    return false;
+#endif
+}
+
+bool w65c02s_hook_brk_cpu(struct w65c02s_cpu *cpu,
+                          bool (*brk_hook)(struct w65c02s_cpu *, uint8_t)) {
 #if W65C02S_HOOK_BRK
     cpu->hook_brk = brk_hook;
     return true;
@@ -3096,6 +5260,19 @@ bool w65c02s_hook_brk(struct w65c02s_cpu *cpu, bool (*brk_hook)(uint8_t)) {
 
 /* stp_hook: 0 = treat STP as normal, <>0 = treat it as NOP */
 bool w65c02s_hook_stp(struct w65c02s_cpu *cpu, bool (*stp_hook)(void)) {
+#if W65C02S_HOOK_STP
+    cpu->hook_stp_plain = stp_hook;
+    cpu->hook_stp = stp_hook ? &w65c02s_call_stp_plain : NULL;
+    return true;
+#else
+    (void)cpu;
+    (void)stp_hook;
+    return false;
+#endif
+}
+
+bool w65c02s_hook_stp_cpu(struct w65c02s_cpu *cpu,
+                          bool (*stp_hook)(struct w65c02s_cpu *)) {
 #if W65C02S_HOOK_STP
     cpu->hook_stp = stp_hook;
     return true;
@@ -3108,6 +5285,19 @@ bool w65c02s_hook_stp(struct w65c02s_cpu *cpu, bool (*stp_hook)(void)) {
 
 bool w65c02s_hook_end_of_instruction(struct w65c02s_cpu *cpu,
                                      void (*instruction_hook)(void)) {
+#if W65C02S_HOOK_EOI
+    cpu->hook_eoi_plain = instruction_hook;
+    cpu->hook_eoi = instruction_hook ? &w65c02s_call_eoi_plain : NULL;
+    return true;
+#else
+    (void)cpu;
+    (void)instruction_hook;
+    return false;
+#endif
+}
+
+bool w65c02s_hook_end_of_instruction_cpu(struct w65c02s_cpu *cpu,
+                            bool (*instruction_hook)(struct w65c02s_cpu *)) {
 #if W65C02S_HOOK_EOI
     cpu->hook_eoi = instruction_hook;
     return true;
@@ -3118,13 +5308,507 @@ bool w65c02s_hook_end_of_instruction(struct w65c02s_cpu *cpu,
 #endif
 }
 
+bool w65c02s_hook_idle_loop(struct w65c02s_cpu *cpu,
+                            bool (*idle_hook)(uint16_t address)) {
+#if W65C02S_IDLE_LOOP
+    cpu->hook_idle_plain = idle_hook;
+    cpu->hook_idle = idle_hook ? &w65c02s_call_idle_plain : NULL;
+    cpu->idle.valid = false;
+    return true;
+#else
+    (void)cpu;
+    (void)idle_hook;
+    return false;
+#endif
+}
+
+bool w65c02s_hook_idle_loop_cpu(struct w65c02s_cpu *cpu,
+                    bool (*idle_hook)(struct w65c02s_cpu *, uint16_t address)) {
+#if W65C02S_IDLE_LOOP
+    cpu->hook_idle = idle_hook;
+    cpu->idle.valid = false;
+    return true;
+#else
+    (void)cpu;
+    (void)idle_hook;
+    return false;
+#endif
+}
+
+bool w65c02s_hook_trace(struct w65c02s_cpu *cpu,
+                        struct w65c02s_trace_record *buffer, size_t size,
+                        struct w65c02s_trace_record *(*trace_hook)(
+                            struct w65c02s_cpu *,
+                            struct w65c02s_trace_record *, size_t)) {
+#if W65C02S_HOOK_TRACE
+    if (cpu->hook_trace) w65c02s_trace_flush(cpu);
+    cpu->hook_trace = size ? trace_hook : NULL;
+    cpu->trace.buffer = buffer;
+    cpu->trace.size = size;
+    cpu->trace.count = 0;
+    return true;
+#else
+    (void)cpu;
+    (void)buffer;
+    (void)size;
+    (void)trace_hook;
+    return false;
+#endif
+}
+
+void w65c02s_flush_trace(struct w65c02s_cpu *cpu) {
+#if W65C02S_HOOK_TRACE
+    if (cpu->hook_trace) w65c02s_trace_flush(cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+bool w65c02s_map_pages(struct w65c02s_cpu *cpu, unsigned page, unsigned pages,
+                       const uint8_t *read, uint8_t *write) {
+#if W65C02S_PAGE_TABLE
+    unsigned i;
+    if (page > 256 || pages > 256 - page) return false;
+    for (i = 0; i < pages; ++i) {
+        cpu->page_read[page + i] = read ? read + i * 256 : NULL;
+        cpu->page_write[page + i] = write ? write + i * 256 : NULL;
+    }
+    return true;
+#else
+    (void)cpu;
+    (void)page;
+    (void)pages;
+    (void)read;
+    (void)write;
+    return false;
+#endif
+}
+
+bool w65c02s_set_wait_states(struct w65c02s_cpu *cpu, unsigned page,
+                             unsigned pages, unsigned cycles) {
+#if W65C02S_WAIT_STATES
+    unsigned i;
+    if (page > 256 || pages > 256 - page) return false;
+    for (i = 0; i < pages; ++i)
+        cpu->wait_states[page + i] = (uint8_t)cycles;
+    return true;
+#else
+    (void)cpu;
+    (void)page;
+    (void)pages;
+    (void)cycles;
+    return false;
+#endif
+}
+
+bool w65c02s_map_io(struct w65c02s_cpu *cpu, uint16_t start, uint16_t end,
+                    uint8_t (*read)(struct w65c02s_cpu *, uint16_t,
+                                    unsigned long, void *),
+                    void (*write)(struct w65c02s_cpu *, uint16_t, uint8_t,
+                                  unsigned long, void *),
+                    void *data) {
+#if W65C02S_IO_REGIONS
+    unsigned i, j;
+    if (start > end || cpu->io_count >= W65C02S_IO_REGIONS) return false;
+    /* find where to insert the range and check its neighbors */
+    for (i = 0; i < cpu->io_count && cpu->io[i].start < start; ++i)
+        ;
+    if (i > 0 && cpu->io[i - 1].end >= start) return false;
+    if (i < cpu->io_count && cpu->io[i].start <= end) return false;
+    for (j = cpu->io_count++; j > i; --j)
+        cpu->io[j] = cpu->io[j - 1];
+    cpu->io[i].read = read;
+    cpu->io[i].write = write;
+    cpu->io[i].data = data;
+    cpu->io[i].start = start;
+    cpu->io[i].end = end;
+    w65c02s_io_update(cpu);
+    return true;
+#else
+    (void)cpu;
+    (void)start;
+    (void)end;
+    (void)read;
+    (void)write;
+    (void)data;
+    return false;
+#endif
+}
+
+bool w65c02s_unmap_io(struct w65c02s_cpu *cpu, uint16_t address) {
+#if W65C02S_IO_REGIONS
+    unsigned i;
+    const struct w65c02s_io_region *io = w65c02s_io_find(cpu, address);
+    if (!io) return false;
+    for (i = (unsigned)(io - cpu->io) + 1; i < cpu->io_count; ++i)
+        cpu->io[i - 1] = cpu->io[i];
+    --cpu->io_count;
+    w65c02s_io_update(cpu);
+    return true;
+#else
+    (void)cpu;
+    (void)address;
+    return false;
+#endif
+}
+
+bool w65c02s_share_range(struct w65c02s_cpu *cpu, uint16_t start,
+                         uint16_t end, struct w65c02s_cpu *other) {
+#if W65C02S_SHARED
+    struct w65c02s_shared_range *range;
+    if (start > end || other == cpu || cpu->shared_count >= W65C02S_SHARED)
+        return false;
+    range = &cpu->shared[cpu->shared_count++];
+    range->other = other;
+    range->start = start;
+    range->end = end;
+    w65c02s_share_update(cpu);
+    return true;
+#else
+    (void)cpu;
+    (void)start;
+    (void)end;
+    (void)other;
+    return false;
+#endif
+}
+
+bool w65c02s_unshare_ranges(struct w65c02s_cpu *cpu,
+                            struct w65c02s_cpu *other) {
+#if W65C02S_SHARED
+    unsigned i, j = 0;
+    for (i = 0; i < cpu->shared_count; ++i)
+        if (other && cpu->shared[i].other != other)
+            cpu->shared[j++] = cpu->shared[i];
+    if (j == cpu->shared_count) return false;
+    cpu->shared_count = j;
+    w65c02s_share_update(cpu);
+    return true;
+#else
+    (void)cpu;
+    (void)other;
+    return false;
+#endif
+}
+
+bool w65c02s_fetch_dirty_pages(struct w65c02s_cpu *cpu, uint8_t *bitmap) {
+    unsigned i;
+#if W65C02S_DIRTY_PAGES
+    uint8_t any = 0;
+    for (i = 0; i < 32; ++i) {
+        any |= bitmap[i] = cpu->dirty[i];
+        cpu->dirty[i] = 0;
+    }
+    return any != 0;
+#else
+    (void)cpu;
+    for (i = 0; i < 32; ++i) bitmap[i] = 0xFF;
+    return true;
+#endif
+}
+
+bool w65c02s_set_heatmap(struct w65c02s_cpu *cpu, unsigned long *counters) {
+#if W65C02S_HEATMAP
+    cpu->heatmap = counters;
+    return true;
+#else
+    (void)cpu;
+    (void)counters;
+    return false;
+#endif
+}
+
+size_t w65c02s_heatmap_top(const unsigned long *counters, unsigned kind,
+                           uint16_t *addresses, size_t n) {
+    unsigned long addr;
+    size_t found = 0;
+    if (!n) return 0;
+    counters += kind * 0x10000UL;
+    for (addr = 0; addr < 0x10000UL; ++addr) {
+        unsigned long count = counters[addr];
+        size_t i;
+        if (!count) continue;
+        if (found == n && count <= counters[addresses[n - 1]]) continue;
+        /* insertion sort into the list, dropping the last one if full */
+        i = found < n ? found++ : n - 1;
+        for (; i > 0 && counters[addresses[i - 1]] < count; --i)
+            addresses[i] = addresses[i - 1];
+        addresses[i] = (uint16_t)addr;
+    }
+    return found;
+}
+
+#if W65C02S_DISASM
+/* addressing modes of the disassembler, by those of the opcode table */
+#define W65C02S_DISASM_MODE_IMPLIED             W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_IMPLIED_X           W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_IMPLIED_Y           W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_IMMEDIATE           W65C02S_DISASM_IMMEDIATE
+#define W65C02S_DISASM_MODE_RELATIVE            W65C02S_DISASM_RELATIVE
+#define W65C02S_DISASM_MODE_RELATIVE_BIT        W65C02S_DISASM_ZEROPAGE_RELATIVE
+#define W65C02S_DISASM_MODE_ZEROPAGE            W65C02S_DISASM_ZEROPAGE
+#define W65C02S_DISASM_MODE_ZEROPAGE_X          W65C02S_DISASM_ZEROPAGE_X
+#define W65C02S_DISASM_MODE_ZEROPAGE_Y          W65C02S_DISASM_ZEROPAGE_Y
+#define W65C02S_DISASM_MODE_ZEROPAGE_BIT        W65C02S_DISASM_ZEROPAGE
+#define W65C02S_DISASM_MODE_ABSOLUTE            W65C02S_DISASM_ABSOLUTE
+#define W65C02S_DISASM_MODE_ABSOLUTE_X          W65C02S_DISASM_ABSOLUTE_X
+#define W65C02S_DISASM_MODE_ABSOLUTE_Y          W65C02S_DISASM_ABSOLUTE_Y
+#define W65C02S_DISASM_MODE_ZEROPAGE_INDIRECT   W65C02S_DISASM_ZEROPAGE_INDIRECT
+#define W65C02S_DISASM_MODE_ZEROPAGE_INDIRECT_X                                \
+                                        W65C02S_DISASM_ZEROPAGE_INDIRECT_X
+#define W65C02S_DISASM_MODE_ZEROPAGE_INDIRECT_Y                                \
+                                        W65C02S_DISASM_ZEROPAGE_INDIRECT_Y
+#define W65C02S_DISASM_MODE_ABSOLUTE_INDIRECT   W65C02S_DISASM_ABSOLUTE_INDIRECT
+#define W65C02S_DISASM_MODE_ABSOLUTE_INDIRECT_X                                \
+                                        W65C02S_DISASM_ABSOLUTE_INDIRECT_X
+#define W65C02S_DISASM_MODE_ABSOLUTE_JUMP       W65C02S_DISASM_ABSOLUTE
+#define W65C02S_DISASM_MODE_RMW_ZEROPAGE        W65C02S_DISASM_ZEROPAGE
+#define W65C02S_DISASM_MODE_RMW_ZEROPAGE_X      W65C02S_DISASM_ZEROPAGE_X
+#define W65C02S_DISASM_MODE_SUBROUTINE          W65C02S_DISASM_ABSOLUTE
+#define W65C02S_DISASM_MODE_RETURN_SUB          W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_RMW_ABSOLUTE        W65C02S_DISASM_ABSOLUTE
+#define W65C02S_DISASM_MODE_RMW_ABSOLUTE_X      W65C02S_DISASM_ABSOLUTE_X
+#define W65C02S_DISASM_MODE_NOP_5C              W65C02S_DISASM_ABSOLUTE
+#define W65C02S_DISASM_MODE_INT_WAIT_STOP       W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_STACK_PUSH          W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_STACK_PULL          W65C02S_DISASM_IMPLIED
+/* the byte after BRK is shown as an operand */
+#define W65C02S_DISASM_MODE_STACK_BRK           W65C02S_DISASM_IMMEDIATE
+#define W65C02S_DISASM_MODE_STACK_RTI           W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_IMPLIED_1C          W65C02S_DISASM_IMPLIED
+#define W65C02S_DISASM_MODE_ABSOLUTE_X_STORE    W65C02S_DISASM_ABSOLUTE_X
+#define W65C02S_DISASM_MODE_ABSOLUTE_Y_STORE    W65C02S_DISASM_ABSOLUTE_Y
+#define W65C02S_DISASM_MODE_ZEROPAGE_INDIRECT_Y_STORE                          \
+                                        W65C02S_DISASM_ZEROPAGE_INDIRECT_Y
+
+static const uint8_t w65c02s_disasm_modes[256] = {
+#define W65C02S_OPCODE(opcode, o_mode, o_oper)                                 \
+    W65C02S_DISASM_MODE_ ## o_mode,
+W65C02S_OPCODE_TABLE()
+#undef W65C02S_OPCODE
+};
+
+static const char w65c02s_disasm_mnemonics[256][5] = {
+    "BRK",  "ORA",  "NOP",  "NOP",  "TSB",  "ORA",  "ASL",  "RMB0",
+    "PHP",  "ORA",  "ASL",  "NOP",  "TSB",  "ORA",  "ASL",  "BBR0",
+    "BPL",  "ORA",  "ORA",  "NOP",  "TRB",  "ORA",  "ASL",  "RMB1",
+    "CLC",  "ORA",  "INC",  "NOP",  "TRB",  "ORA",  "ASL",  "BBR1",
+    "JSR",  "AND",  "NOP",  "NOP",  "BIT",  "AND",  "ROL",  "RMB2",
+    "PLP",  "AND",  "ROL",  "NOP",  "BIT",  "AND",  "ROL",  "BBR2",
+    "BMI",  "AND",  "AND",  "NOP",  "BIT",  "AND",  "ROL",  "RMB3",
+    "SEC",  "AND",  "DEC",  "NOP",  "BIT",  "AND",  "ROL",  "BBR3",
+    "RTI",  "EOR",  "NOP",  "NOP",  "NOP",  "EOR",  "LSR",  "RMB4",
+    "PHA",  "EOR",  "LSR",  "NOP",  "JMP",  "EOR",  "LSR",  "BBR4",
+    "BVC",  "EOR",  "EOR",  "NOP",  "NOP",  "EOR",  "LSR",  "RMB5",
+    "CLI",  "EOR",  "PHY",  "NOP",  "NOP",  "EOR",  "LSR",  "BBR5",
+    "RTS",  "ADC",  "NOP",  "NOP",  "STZ",  "ADC",  "ROR",  "RMB6",
+    "PLA",  "ADC",  "ROR",  "NOP",  "JMP",  "ADC",  "ROR",  "BBR6",
+    "BVS",  "ADC",  "ADC",  "NOP",  "STZ",  "ADC",  "ROR",  "RMB7",
+    "SEI",  "ADC",  "PLY",  "NOP",  "JMP",  "ADC",  "ROR",  "BBR7",
+    "BRA",  "STA",  "NOP",  "NOP",  "STY",  "STA",  "STX",  "SMB0",
+    "DEY",  "BIT",  "TXA",  "NOP",  "STY",  "STA",  "STX",  "BBS0",
+    "BCC",  "STA",  "STA",  "NOP",  "STY",  "STA",  "STX",  "SMB1",
+    "TYA",  "STA",  "TXS",  "NOP",  "STZ",  "STA",  "STZ",  "BBS1",
+    "LDY",  "LDA",  "LDX",  "NOP",  "LDY",  "LDA",  "LDX",  "SMB2",
+    "TAY",  "LDA",  "TAX",  "NOP",  "LDY",  "LDA",  "LDX",  "BBS2",
+    "BCS",  "LDA",  "LDA",  "NOP",  "LDY",  "LDA",  "LDX",  "SMB3",
+    "CLV",  "LDA",  "TSX",  "NOP",  "LDY",  "LDA",  "LDX",  "BBS3",
+    "CPY",  "CMP",  "NOP",  "NOP",  "CPY",  "CMP",  "DEC",  "SMB4",
+    "INY",  "CMP",  "DEX",  "WAI",  "CPY",  "CMP",  "DEC",  "BBS4",
+    "BNE",  "CMP",  "CMP",  "NOP",  "NOP",  "CMP",  "DEC",  "SMB5",
+    "CLD",  "CMP",  "PHX",  "STP",  "NOP",  "CMP",  "DEC",  "BBS5",
+    "CPX",  "SBC",  "NOP",  "NOP",  "CPX",  "SBC",  "INC",  "SMB6",
+    "INX",  "SBC",  "NOP",  "NOP",  "CPX",  "SBC",  "INC",  "BBS6",
+    "BEQ",  "SBC",  "SBC",  "NOP",  "NOP",  "SBC",  "INC",  "SMB7",
+    "SED",  "SBC",  "PLX",  "NOP",  "NOP",  "SBC",  "INC",  "BBS7",
+};
+
+static const uint8_t w65c02s_disasm_cycles[256] = {
+    7, 6, 2, 1, 5, 3, 5, 5, 3, 2, 2, 1, 6, 4, 6, 5,
+    2, 5, 5, 1, 5, 4, 6, 5, 2, 4, 2, 1, 6, 4, 6, 5,
+    6, 6, 2, 1, 3, 3, 5, 5, 4, 2, 2, 1, 4, 4, 6, 5,
+    2, 5, 5, 1, 4, 4, 6, 5, 2, 4, 2, 1, 4, 4, 6, 5,
+    6, 6, 2, 1, 3, 3, 5, 5, 3, 2, 2, 1, 3, 4, 6, 5,
+    2, 5, 5, 1, 4, 4, 6, 5, 2, 4, 3, 1, 8, 4, 6, 5,
+    6, 6, 2, 1, 3, 3, 5, 5, 4, 2, 2, 1, 6, 4, 6, 5,
+    2, 5, 5, 1, 4, 4, 6, 5, 2, 4, 4, 1, 6, 4, 6, 5,
+    3, 6, 2, 1, 3, 3, 3, 5, 2, 2, 2, 1, 4, 4, 4, 5,
+    2, 6, 5, 1, 4, 4, 4, 5, 2, 5, 2, 1, 4, 5, 5, 5,
+    2, 6, 2, 1, 3, 3, 3, 5, 2, 2, 2, 1, 4, 4, 4, 5,
+    2, 5, 5, 1, 4, 4, 4, 5, 2, 4, 2, 1, 4, 4, 4, 5,
+    2, 6, 2, 1, 3, 3, 5, 5, 2, 2, 2, 3, 4, 4, 6, 5,
+    2, 5, 5, 1, 4, 4, 6, 5, 2, 4, 3, 3, 4, 4, 7, 5,
+    2, 6, 2, 1, 3, 3, 5, 5, 2, 2, 2, 1, 4, 4, 6, 5,
+    2, 5, 5, 1, 4, 4, 6, 5, 2, 4, 4, 1, 4, 4, 7, 5,
+};
+
+/* by W65C02S_DISASM_* */
+static const uint8_t w65c02s_disasm_lengths[15] = {
+    1, 2, 2, 3, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3
+};
+
+W65C02S_INLINE unsigned w65c02s_disassemble_one(struct w65c02s_disasm *insn,
+                                                uint16_t address,
+                                                const uint8_t *bytes) {
+    uint8_t opcode = bytes[0];
+    unsigned mode = w65c02s_disasm_modes[opcode];
+    unsigned length = w65c02s_disasm_lengths[mode];
+    uint16_t operand = 0, target = 0;
+
+    if (length > 1) operand = bytes[1];
+    if (length > 2) operand |= bytes[2] << 8;
+    /* branches are relative to the next instruction */
+    if (mode == W65C02S_DISASM_RELATIVE)
+        target = (uint16_t)(address + 2 + (operand ^ 0x80) - 0x80);
+    else if (mode == W65C02S_DISASM_ZEROPAGE_RELATIVE)
+        target = (uint16_t)(address + 3 + ((operand >> 8) ^ 0x80) - 0x80);
+
+    insn->mnemonic = w65c02s_disasm_mnemonics[opcode];
+    insn->address = address;
+    insn->operand = operand;
+    insn->target = target;
+    insn->opcode = opcode;
+    insn->mode = (uint8_t)mode;
+    insn->length = (uint8_t)length;
+    insn->cycles = w65c02s_disasm_cycles[opcode];
+    return length;
+}
+
+static char *w65c02s_disasm_hex(char *p, unsigned v, unsigned digits) {
+    static const char hex[] = "0123456789ABCDEF";
+    *p++ = '$';
+    while (digits--) *p++ = hex[(v >> (digits * 4)) & 15];
+    return p;
+}
+
+static char *w65c02s_disasm_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+#endif /* W65C02S_DISASM */
+
+unsigned w65c02s_disassemble(struct w65c02s_disasm *insn, uint16_t address,
+                             const uint8_t *bytes) {
+#if W65C02S_DISASM
+    return w65c02s_disassemble_one(insn, address, bytes);
+#else
+    (void)insn;
+    (void)address;
+    (void)bytes;
+    return 0;
+#endif
+}
+
+size_t w65c02s_disassemble_range(struct w65c02s_disasm *insns, size_t n,
+                                 uint16_t address, const uint8_t *bytes,
+                                 size_t size) {
+#if W65C02S_DISASM
+    size_t count = 0, offset = 0;
+    /* decode in place while at least 3 bytes are left */
+    while (count < n && size - offset >= 3) {
+        offset += w65c02s_disassemble_one(&insns[count++],
+                            (uint16_t)(address + offset), bytes + offset);
+    }
+    /* the last instructions may be shorter than 3 bytes */
+    while (count < n && offset < size) {
+        uint8_t tail[3] = { 0, 0, 0 };
+        size_t i;
+        for (i = 0; i < 3 && offset + i < size; ++i)
+            tail[i] = bytes[offset + i];
+        if (offset + w65c02s_disasm_lengths[w65c02s_disasm_modes[tail[0]]]
+                > size) break;
+        offset += w65c02s_disassemble_one(&insns[count++],
+                            (uint16_t)(address + offset), tail);
+    }
+    return count;
+#else
+    (void)insns;
+    (void)n;
+    (void)address;
+    (void)bytes;
+    (void)size;
+    return 0;
+#endif
+}
+
+size_t w65c02s_disasm_operand(const struct w65c02s_disasm *insn, char *buf) {
+    char *p = buf;
+#if W65C02S_DISASM
+    unsigned v = insn->operand;
+    switch (insn->mode) {
+    case W65C02S_DISASM_IMMEDIATE:
+        *p++ = '#';
+        p = w65c02s_disasm_hex(p, v, 2);
+        break;
+    case W65C02S_DISASM_RELATIVE:
+    case W65C02S_DISASM_ZEROPAGE:
+        p = w65c02s_disasm_hex(p, v, 2);
+        break;
+    case W65C02S_DISASM_ZEROPAGE_RELATIVE:
+        p = w65c02s_disasm_hex(p, v & 0xFF, 2);
+        *p++ = ',';
+        p = w65c02s_disasm_hex(p, v >> 8, 2);
+        break;
+    case W65C02S_DISASM_ZEROPAGE_X:
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 2), ",X");
+        break;
+    case W65C02S_DISASM_ZEROPAGE_Y:
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 2), ",Y");
+        break;
+    case W65C02S_DISASM_ZEROPAGE_INDIRECT:
+        *p++ = '(';
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 2), ")");
+        break;
+    case W65C02S_DISASM_ZEROPAGE_INDIRECT_X:
+        *p++ = '(';
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 2), ",X)");
+        break;
+    case W65C02S_DISASM_ZEROPAGE_INDIRECT_Y:
+        *p++ = '(';
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 2), "),Y");
+        break;
+    case W65C02S_DISASM_ABSOLUTE:
+        p = w65c02s_disasm_hex(p, v, 4);
+        break;
+    case W65C02S_DISASM_ABSOLUTE_X:
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 4), ",X");
+        break;
+    case W65C02S_DISASM_ABSOLUTE_Y:
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 4), ",Y");
+        break;
+    case W65C02S_DISASM_ABSOLUTE_INDIRECT:
+        *p++ = '(';
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 4), ")");
+        break;
+    case W65C02S_DISASM_ABSOLUTE_INDIRECT_X:
+        *p++ = '(';
+        p = w65c02s_disasm_str(w65c02s_disasm_hex(p, v, 4), ",X)");
+        break;
+    }
+#else
+    (void)insn;
+#endif
+    *p = 0;
+    return (size_t)(p - buf);
+}
+
 unsigned long w65c02s_get_cycle_count(const struct w65c02s_cpu *cpu) {
-    return cpu->total_cycles;
+    return (unsigned long)cpu->total_cycles;
 }
 
 unsigned long w65c02s_get_instruction_count(const struct w65c02s_cpu *cpu) {
+    return (unsigned long)cpu->total_instructions;
+}
+
+#if W65C02S_COUNTER_64
+uint64_t w65c02s_get_cycle_count64(const struct w65c02s_cpu *cpu) {
+    return cpu->total_cycles;
+}
+
+uint64_t w65c02s_get_instruction_count64(const struct w65c02s_cpu *cpu) {
     return cpu->total_instructions;
 }
+#endif
 
 void w65c02s_reset_cycle_count(struct w65c02s_cpu *cpu) {
     cpu->total_cycles = 0;
@@ -3171,6 +5855,80 @@ void w65c02s_reg_set_p(struct w65c02s_cpu *cpu, uint8_t v) {
     w65c02s_irq_update_mask(cpu);
 }
 
+bool w65c02s_save_state(const struct w65c02s_cpu *cpu,
+                        struct w65c02s_state *state) {
+#if !W65C02S_COARSE
+    if (cpu->cycl) return false;
+#endif
+#if W65C02S_STALLS
+    /* a hold can start on the last cycle of an instruction */
+    if (cpu->rdy_cont || cpu->rdy_cycles) return false;
+#endif
+#if W65C02S_WAIT_STATES
+    if (cpu->wait_cycles) return false;
+#endif
+    state->total_cycles = (unsigned long)cpu->total_cycles;
+    state->total_instructions = (unsigned long)cpu->total_instructions;
+    state->total_cycles_high = W65C02S_COUNT_HIGH(cpu->total_cycles);
+    state->total_instructions_high =
+                            W65C02S_COUNT_HIGH(cpu->total_instructions);
+    state->stall_cycles = cpu->stall_cycles;
+    state->cpu_state = W65C02S_CPU_STATE_EXTRACT_WITH_INTS(cpu->cpu_state);
+    state->int_trig = cpu->int_trig;
+    state->irq_sources = cpu->irq_sources;
+    state->irq_held = cpu->irq_held;
+    state->pc = cpu->pc;
+    state->a = cpu->a;
+    state->x = cpu->x;
+    state->y = cpu->y;
+    state->s = cpu->s;
+    state->p = cpu->p;
+    state->in_nmi = cpu->in_nmi;
+    state->in_rst = cpu->in_rst;
+    state->in_irq = cpu->in_irq;
+    return true;
+}
+
+void w65c02s_load_state(struct w65c02s_cpu *cpu,
+                        const struct w65c02s_state *state) {
+#if !W65C02S_COARSE
+    cpu->cycl = 0;
+#endif
+#if W65C02S_STALLS
+    cpu->rdy_cycles = cpu->rdy_spent = 0;
+    cpu->rdy_repeat = cpu->rdy_cont = false;
+#if !W65C02S_COARSE
+    cpu->rdy_latch = 0;
+#endif
+#endif
+#if W65C02S_WAIT_STATES
+    cpu->wait_cycles = 0;
+#endif
+    cpu->total_cycles = state->total_cycles
+                      | W65C02S_COUNT_FROM_HIGH(state->total_cycles_high);
+    cpu->total_instructions = state->total_instructions
+                | W65C02S_COUNT_FROM_HIGH(state->total_instructions_high);
+    cpu->stall_cycles = state->stall_cycles;
+    cpu->cpu_state = W65C02S_CPU_STATE_EXTRACT_WITH_INTS(state->cpu_state);
+    cpu->int_trig = state->int_trig;
+    cpu->irq_sources = state->irq_sources;
+    cpu->irq_held = state->irq_held;
+    cpu->pc = state->pc;
+    cpu->a = state->a;
+    cpu->x = state->x;
+    cpu->y = state->y;
+    cpu->s = state->s;
+    cpu->p = state->p;
+    cpu->in_nmi = state->in_nmi;
+    cpu->in_rst = state->in_rst;
+    cpu->in_irq = state->in_irq;
+    w65c02s_irq_update_mask(cpu);
+#if W65C02S_IDLE_LOOP
+    cpu->idle.valid = false;
+    cpu->idle.skip_cycles = 0;
+#endif
+}
+
 #endif /* W65C02S_IMPL */
 
 #ifdef __cplusplus
@@ -4,7 +4,7 @@
             by ziplantil 2022 -- under the CC0 license
             version: 2022-11-05
 
-            busdump.c - bus dump program
+            benchmark.c - benchmark program
 *******************************************************************************/
 
 #include <ctype.h>
@@ -16,6 +16,7 @@
 #define W65C02S_IMPL 1
 #define W65C02S_LINK 1
 #include "w65c02s.h"
+#include "image.h"
 
 #define INSTRS 0
 
@@ -49,17 +50,7 @@ static double measurement_sample(struct measurement *m) {
 }
 
 static size_t loadmemfromfile(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    size_t size = 0;
-
-    if (!file) {
-        perror("fopen");
-        return 0;
-    }
-
-    size = fread(ram, 1, 0x10000UL, file);
-    fclose(file);
-    return size;
+    return image_read(filename, ram, sizeof(ram));
 }
 
 int main(int argc, char *argv[]) {
@@ -87,6 +78,7 @@ int main(int argc, char *argv[]) {
     printf("Running %lu cycles\n", cycles);
 #endif
     
+    w65c02s_init_decimal_tables();
     w65c02s_init(&cpu, NULL, NULL, NULL);
     
     for (i = 0; i < tries; ++i) {
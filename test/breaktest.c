@@ -16,11 +16,9 @@
 #define W65C02S_IMPL 1
 #define W65C02S_LINK 1
 #include "w65c02s.h"
+#include "image.h"
 
-#if __STDC_VERSION__ >= 201112L
-_Alignas(128)
-#endif
-uint8_t ram[65536];
+uint8_t *ram;
 struct w65c02s_cpu cpu;
 unsigned long cycles;
 unsigned long break_cycles;
@@ -38,17 +36,9 @@ void w65c02s_write(uint16_t a, uint8_t v) {
 uint16_t vector = 0;
 
 static size_t loadmemfromfile(const char *filename) {
-    FILE *file = fopen(filename, "rb");
     size_t size = 0;
-
-    if (!file) {
-        perror("fopen");
-        return 0;
-    }
-
-    size = fread(ram, 1, 0x10000UL, file);
-    fclose(file);
-    return size;
+    ram = image_map_ram(filename, &size);
+    return ram ? size : 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -0,0 +1,203 @@
+/*******************************************************************************
+            w65c02s.h -- cycle-accurate C emulator of the WDC 65C02S
+                         as a single-header library
+            by ziplantil 2022 -- under the CC0 license
+            version: 2022-11-05
+
+            busdiff.c - finds the first difference between two bus dumps
+*******************************************************************************/
+
+/* compares two traces in the format written by busdump.c, such as an
+   emulator run and a logic analyzer capture converted to the same format,
+   and prints the records around the first difference.
+
+   with mmap, both traces are mapped whole and compared a large window at a
+   time; otherwise they are read front to back a large chunk at a time,
+   without seeking, so traces past 2 GiB work even where long is 32-bit.
+   either way, equal windows are compared with a single memcmp, so even
+   traces of several gigabytes take seconds. with -b, only the bus itself
+   (read/write, address and data) is compared, for traces that do not
+   record the rest. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+#define RECORD_SIZE 8
+/* records compared at once */
+#define WINDOW_RECORDS (1UL << 17)
+/* most records printed before and after the difference */
+#define CONTEXT_MAX 1024UL
+
+struct trace {
+    const char *name;
+#if IMAGE_MMAP
+    const unsigned char *map;
+    size_t size;
+#else
+    FILE *file;
+    /* records buf_first.. are in buf. the first CONTEXT_MAX of them (if
+       there were as many) are kept from the last chunk read, so that the
+       context before a difference is still there */
+    unsigned char buf[(CONTEXT_MAX + WINDOW_RECORDS) * RECORD_SIZE];
+    unsigned long buf_first;
+    size_t buf_count;
+#endif
+};
+
+static struct trace trace_a, trace_b;
+static int bus_only;
+
+static int trace_open(struct trace *t, const char *name) {
+    t->name = name;
+#if IMAGE_MMAP
+    t->map = image_map_rom(name, &t->size);
+    return t->map != NULL;
+#else
+    t->file = fopen(name, "rb");
+    if (!t->file) {
+        perror("fopen");
+        return 0;
+    }
+    t->buf_first = t->buf_count = 0;
+    return 1;
+#endif
+}
+
+static void trace_close(struct trace *t) {
+#if IMAGE_MMAP
+    image_unmap(t->map, t->size);
+#else
+    fclose(t->file);
+#endif
+}
+
+/* points *records to the records from index on, returns how many there
+   are (at most WINDOW_RECORDS, 0 at the end of the trace). without mmap,
+   index may only go back CONTEXT_MAX records from the furthest so far */
+static size_t trace_window(struct trace *t, unsigned long index,
+                           const unsigned char **records) {
+#if IMAGE_MMAP
+    unsigned long count = t->size / RECORD_SIZE;
+    if (index >= count) return 0;
+    *records = t->map + (size_t)index * RECORD_SIZE;
+    count -= index;
+    return count < WINDOW_RECORDS ? count : WINDOW_RECORDS;
+#else
+    if (index < t->buf_first) return 0;
+    while (index >= t->buf_first + t->buf_count) {
+        /* read on, keeping the last CONTEXT_MAX records */
+        size_t keep = t->buf_count < CONTEXT_MAX ? t->buf_count : CONTEXT_MAX;
+        size_t n;
+        memmove(t->buf, t->buf + (t->buf_count - keep) * RECORD_SIZE,
+                keep * RECORD_SIZE);
+        t->buf_first += t->buf_count - keep;
+        t->buf_count = keep;
+        n = fread(t->buf + keep * RECORD_SIZE, RECORD_SIZE, WINDOW_RECORDS,
+                  t->file);
+        if (!n) return 0;
+        t->buf_count += n;
+    }
+    *records = t->buf + (index - t->buf_first) * RECORD_SIZE;
+    return t->buf_count - (index - t->buf_first);
+#endif
+}
+
+static int record_equal(const unsigned char *a, const unsigned char *b) {
+    if (!bus_only) return !memcmp(a, b, RECORD_SIZE);
+    return (a[0] & 0x80) == (b[0] & 0x80) && a[4] == b[4] && a[5] == b[5]
+        && a[7] == b[7];
+}
+
+/* returns the index of the first differing record (or the end of the
+   shorter trace) */
+static unsigned long find_difference(void) {
+    unsigned long index = 0;
+    for (;;) {
+        const unsigned char *a, *b;
+        size_t na = trace_window(&trace_a, index, &a);
+        size_t nb = trace_window(&trace_b, index, &b);
+        size_t n = na < nb ? na : nb, i = 0;
+        if (!n) return index;
+        if (bus_only || memcmp(a, b, n * RECORD_SIZE))
+            while (i < n && record_equal(a + i * RECORD_SIZE,
+                                         b + i * RECORD_SIZE))
+                ++i;
+        else
+            i = n;
+        index += i;
+        if (i < n) return index;
+    }
+}
+
+static void print_record(struct trace *t, unsigned long index, int mark) {
+    const unsigned char *r;
+    if (!trace_window(t, index, &r)) {
+        printf("%c %10lu  (end of %s)\n", mark ? '>' : ' ', index, t->name);
+        return;
+    }
+    /* flags: RESET, NMI/IRQ latched, NMI/IRQ line active */
+    printf("%c %10lu  %c %04X %02X  pc=%04X cyc=%-2u %c%c%c%c%c\n",
+           mark ? '>' : ' ', index, r[0] & 0x80 ? 'W' : 'R',
+           r[4] | r[5] << 8, r[7], r[2] | r[3] << 8, r[1],
+           r[0] & 16 ? 'R' : '-', r[0] & 8 ? 'N' : '-',
+           r[0] & 4 ? 'I' : '-', r[0] & 2 ? 'n' : '-',
+           r[0] & 1 ? 'i' : '-');
+}
+
+static void print_context(struct trace *t, unsigned long index,
+                          unsigned long context) {
+    unsigned long i = index > context ? index - context : 0;
+    printf("%s:\n", t->name);
+    for (; i <= index + context; ++i) {
+        const unsigned char *r;
+        print_record(t, i, i == index);
+        if (!trace_window(t, i, &r)) break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long context = 8, index;
+    const unsigned char *r;
+    int i = 1, same;
+
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (!strcmp(argv[i], "-b")) {
+            bus_only = 1;
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            context = strtoul(argv[++i], NULL, 0);
+            if (context > CONTEXT_MAX) context = CONTEXT_MAX;
+        } else {
+            break;
+        }
+    }
+    if (argc - i != 2) {
+        printf("%s [-b] [-c context] <trace_a> <trace_b>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!trace_open(&trace_a, argv[i])) {
+        return EXIT_FAILURE;
+    }
+    if (!trace_open(&trace_b, argv[i + 1])) {
+        trace_close(&trace_a);
+        return EXIT_FAILURE;
+    }
+
+    index = find_difference();
+    same = !trace_window(&trace_a, index, &r)
+        && !trace_window(&trace_b, index, &r);
+    if (same) {
+        printf("traces are identical (%lu records)\n", index);
+    } else {
+        printf("first difference at record %lu\n", index);
+        print_context(&trace_a, index, context);
+        print_context(&trace_b, index, context);
+    }
+
+    trace_close(&trace_a);
+    trace_close(&trace_b);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
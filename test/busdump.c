@@ -7,6 +7,21 @@
             busdump.c - bus dump program
 *******************************************************************************/
 
+/* with C11 atomics and POSIX threads, the trace is written to the file by
+   a separate writer thread, fed through a single-producer single-consumer
+   ring buffer. otherwise, it is written directly. */
+#if __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)              \
+        && (defined(__unix__) || defined(__APPLE__))
+#define ASYNC 1
+#else
+#define ASYNC 0
+#endif
+
+#if ASYNC
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#endif
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,15 +30,129 @@
 #define W65C02S_IMPL 1
 #define W65C02S_LINK 1
 #include "w65c02s.h"
+#include "image.h"
 
-uint8_t ram[65536];
+uint8_t *ram;
 FILE *dumpfile;
 struct w65c02s_cpu cpu;
 unsigned long total_cycles;
 unsigned instruction_cycles;
 
+#define RECORD_SIZE 8
+
+#if ASYNC
+/* what to do when the writer thread cannot keep up */
+enum policy {
+    POLICY_BLOCK,   /* wait for the writer, the trace is complete */
+    POLICY_DROP,    /* drop records that do not fit */
+    POLICY_SAMPLE   /* when the ring is 3/4 full, keep 1 of SAMPLE_RATE */
+};
+
+#define RING_RECORDS (1UL << 20) /* must be a power of two */
+#define RING_MASK (RING_RECORDS - 1)
+#define SAMPLE_RATE 16
+
+static unsigned char ring[RING_RECORDS][RECORD_SIZE];
+/* head: next record to write, only written by the emulation thread.
+   tail: next record to read, only written by the writer thread. */
+static atomic_ulong ring_head, ring_tail;
+static atomic_bool ring_done;
+static enum policy policy = POLICY_BLOCK;
+static unsigned long dropped, sample_counter;
+static pthread_t writer;
+
+static void *writer_main(void *arg) {
+    unsigned long tail = atomic_load_explicit(&ring_tail,
+                                              memory_order_relaxed);
+    (void)arg;
+    for (;;) {
+        unsigned long head = atomic_load_explicit(&ring_head,
+                                                  memory_order_acquire);
+        unsigned long n, end;
+        if (head == tail) {
+            if (atomic_load_explicit(&ring_done, memory_order_acquire)
+                && head == atomic_load_explicit(&ring_head,
+                                                memory_order_acquire))
+                break;
+            sched_yield();
+            continue;
+        }
+        /* write everything up to head or to the end of the ring at once */
+        end = (tail & RING_MASK) + (head - tail);
+        n = (end > RING_RECORDS ? RING_RECORDS : end) - (tail & RING_MASK);
+        fwrite(ring[tail & RING_MASK], RECORD_SIZE, n, dumpfile);
+        tail += n;
+        atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+static void trace_put(const unsigned char *rec) {
+    static unsigned long tail;
+    unsigned long head = atomic_load_explicit(&ring_head,
+                                              memory_order_relaxed);
+    if (head - tail >= RING_RECORDS * 3 / 4) {
+        tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+        if (policy == POLICY_BLOCK) {
+            while (head - tail >= RING_RECORDS) {
+                sched_yield();
+                tail = atomic_load_explicit(&ring_tail,
+                                            memory_order_acquire);
+            }
+        } else if (head - tail >= RING_RECORDS
+                || (policy == POLICY_SAMPLE
+                    && head - tail >= RING_RECORDS * 3 / 4
+                    && sample_counter++ % SAMPLE_RATE)) {
+            ++dropped;
+            return;
+        }
+    }
+    memcpy(ring[head & RING_MASK], rec, RECORD_SIZE);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+static int trace_start(const char *name) {
+    if (!strcmp(name, "block")) {
+        policy = POLICY_BLOCK;
+    } else if (!strcmp(name, "drop")) {
+        policy = POLICY_DROP;
+    } else if (!strcmp(name, "sample")) {
+        policy = POLICY_SAMPLE;
+    } else {
+        fprintf(stderr, "unknown policy %s\n", name);
+        return 0;
+    }
+    if (pthread_create(&writer, NULL, writer_main, NULL)) {
+        fprintf(stderr, "could not start writer thread\n");
+        return 0;
+    }
+    return 1;
+}
+
+static void trace_end(void) {
+    atomic_store_explicit(&ring_done, 1, memory_order_release);
+    pthread_join(writer, NULL);
+    if (dropped) fprintf(stderr, "dropped %lu records\n", dropped);
+}
+#else
+static void trace_put(const unsigned char *rec) {
+    fwrite(rec, 1, RECORD_SIZE, dumpfile);
+}
+
+static int trace_start(const char *name) {
+    if (strcmp(name, "block")) {
+        fprintf(stderr, "policy %s needs C11 and POSIX threads\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+static void trace_end(void) {
+}
+#endif
+
 void busdump(unsigned write, uint16_t addr, uint8_t data) {
-    unsigned char buf[8];
+    unsigned char buf[RECORD_SIZE];
     buf[0] = write | (cpu.in_rst ? 16 : 0)
                    | (cpu.cpu_state & 8) /* 8 = NMI, 0 = no NMI */
                    | (cpu.cpu_state & 4) /* 4 = IRQ, 0 = no IRQ */
@@ -36,7 +165,7 @@ void busdump(unsigned write, uint16_t addr, uint8_t data) {
     buf[5] = (addr >> 8) & 0xFF;
     buf[6] = 0;
     buf[7] = data;
-    fwrite(buf, 1, sizeof(buf), dumpfile);
+    trace_put(buf);
 }
 
 uint8_t w65c02s_read(uint16_t a) {
@@ -52,17 +181,9 @@ void w65c02s_write(uint16_t a, uint8_t v) {
 }
 
 static size_t loadmemfromfile(const char *filename) {
-    FILE *file = fopen(filename, "rb");
     size_t size = 0;
-
-    if (!file) {
-        perror("fopen");
-        return 0;
-    }
-
-    size = fread(ram, 1, 0x10000UL, file);
-    fclose(file);
-    return size;
+    ram = image_map_ram(filename, &size);
+    return ram ? size : 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -70,7 +191,8 @@ int main(int argc, char *argv[]) {
     unsigned long cycles;
 
     if (argc <= 4) {
-        printf("%s <file_in> <vector> <cyclecount> <file_out>\n", argv[0]);
+        printf("%s <file_in> <vector> <cyclecount> <file_out> "
+               "[block|drop|sample]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -87,6 +209,11 @@ int main(int argc, char *argv[]) {
     vector = strtoul(argv[2], NULL, 16);
     cycles = strtoul(argv[3], NULL, 0);
 
+    if (!trace_start(argc > 5 ? argv[5] : "block")) {
+        fclose(dumpfile);
+        return EXIT_FAILURE;
+    }
+
     w65c02s_init(&cpu, NULL, NULL, NULL);
     /* RESET cycles */
     w65c02s_run_cycles(&cpu, 7);
@@ -97,6 +224,7 @@ int main(int argc, char *argv[]) {
         total_cycles += w65c02s_step_instruction(&cpu);
     }
 
+    trace_end();
     fclose(dumpfile);
     return EXIT_SUCCESS;
 }
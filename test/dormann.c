@@ -0,0 +1,90 @@
+/*******************************************************************************
+            w65c02s.h -- cycle-accurate C emulator of the WDC 65C02S
+                         as a single-header library
+            by ziplantil 2022 -- under the CC0 license
+            version: 2022-11-05
+
+            dormann.c - runs a Klaus Dormann test binary (see make check)
+*******************************************************************************/
+
+/* the tests end in a trap, an instruction that jumps or branches to itself.
+   the test passes if the trap is the one at the success address, and fails
+   on any other trap (the address tells which test failed). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define W65C02S_IMPL 1
+#define W65C02S_LINK 1
+#include "w65c02s.h"
+#include "image.h"
+
+/* cycles to run between looking for a trap */
+#define SLICE 1000000UL
+
+uint8_t *ram;
+struct w65c02s_cpu cpu;
+
+uint8_t w65c02s_read(uint16_t a) {
+    return ram[a];
+}
+
+void w65c02s_write(uint16_t a, uint8_t v) {
+    ram[a] = v;
+}
+
+static size_t loadmemfromfile(const char *filename) {
+    size_t size = 0;
+    ram = image_map_ram(filename, &size);
+    return ram ? size : 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint16_t start, success, pc;
+    unsigned long max_cycles, cycles = 0;
+    double seconds;
+    clock_t t0;
+
+    if (argc <= 3) {
+        printf("%s <file_in> <start> <success> [max_cycles]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!loadmemfromfile(argv[1])) {
+        return EXIT_FAILURE;
+    }
+
+    start = strtoul(argv[2], NULL, 16);
+    success = strtoul(argv[3], NULL, 16);
+    max_cycles = argc > 4 ? strtoul(argv[4], NULL, 0) : 1000000000UL;
+
+    w65c02s_init(&cpu, NULL, NULL, NULL);
+    /* RESET cycles */
+    w65c02s_run_instructions(&cpu, 1, true);
+    w65c02s_reg_set_pc(&cpu, start);
+
+    t0 = clock();
+    for (;;) {
+        cycles += w65c02s_run_cycles(&cpu, SLICE);
+        /* finish the current instruction, then see if the next one traps */
+        cycles += w65c02s_step_instruction(&cpu);
+        pc = w65c02s_reg_get_pc(&cpu);
+        cycles += w65c02s_step_instruction(&cpu);
+        if (w65c02s_reg_get_pc(&cpu) == pc) break;
+        if (cycles >= max_cycles) {
+            printf("%s: FAIL, no trap after %lu cycles\n", argv[1], cycles);
+            return EXIT_FAILURE;
+        }
+    }
+    seconds = (double)(clock() - t0) / CLOCKS_PER_SEC;
+
+    if (pc != success) {
+        printf("%s: FAIL, trapped at $%04X after %lu cycles\n",
+               argv[1], pc, cycles);
+        return EXIT_FAILURE;
+    }
+    printf("%s: PASS, %lu cycles in %.3f s (%.1f MHz)\n", argv[1], cycles,
+           seconds, seconds > 0 ? cycles / seconds / 1e6 : 0.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,482 @@
+/*******************************************************************************
+            w65c02s.h -- cycle-accurate C emulator of the WDC 65C02S
+                         as a single-header library
+            by ziplantil 2022 -- under the CC0 license
+            version: 2022-11-05
+
+            fuzz.c - differential fuzzer, coarse vs. cycle-exact core
+*******************************************************************************/
+
+/* every case fills memory with random bytes (and thus random instructions),
+   starts the CPU in a random state and runs it on both a W65C02S_COARSE and
+   a cycle-exact core (see fuzzcore.c). the coarse core runs a random number
+   of instructions or cycles at once, the exact core runs in small random
+   chunks of cycles, stopping in the middle of instructions, until it has
+   run as many cycles. IRQ, NMI and RESET are signaled after a random number
+   of memory accesses. the cores must then agree on the registers, cycle and
+   instruction counts, memory and every access made on the bus.
+
+   if the cores are compiled with W65C02S_RDY and W65C02S_WAIT_STATES (as
+   they are for fuzz_stalls, see STALLFLAGS in the Makefile), random pages
+   also get wait states and RDY is held low every so many accesses,
+   including repeated reads of an earlier hold. a second cycle-exact core
+   then runs the cycles in two calls, moving its state into a third one in
+   between, and must agree with the one run in chunks.
+
+   each case also gets a digest of its bus accesses and final state, which
+   can be written to a file with -w and compared against later with -r, e.g.
+   to check a change to the core against the digests of a known good build.
+
+   no idle loop hook is set and no pages are mapped with w65c02s_map_pages,
+   so random memory never reaches those paths even if they are compiled in.
+
+   with POSIX threads, the cases are split between threads. */
+#if defined(__unix__) || defined(__APPLE__)
+#define THREADS 1
+#else
+#define THREADS 0
+#endif
+
+#if THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define W65C02S_PREFIX w65c02s_exact_
+#include "w65c02s.h"
+#undef W65C02S_PREFIX
+#define W65C02S_PREFIX w65c02s_coarse_
+#include "w65c02s.h"
+
+#define MAX_THREADS 256
+#define MAX_REPORTS 10
+
+/* 32-bit xorshift and FNV-1a, since C89 has no 64-bit type */
+#define MASK32 0xFFFFFFFFUL
+
+static unsigned long xorshift(unsigned long *state) {
+    unsigned long x = *state;
+    x ^= (x << 13) & MASK32;
+    x ^= x >> 17;
+    x ^= (x << 5) & MASK32;
+    return *state = x;
+}
+
+static unsigned long fnv(unsigned long hash, unsigned long value) {
+    return ((hash ^ value) * 16777619UL) & MASK32;
+}
+
+/* memory and bus state of one core */
+struct machine {
+    uint8_t mem[65536];
+    unsigned long hash; /* of all accesses */
+    unsigned long accesses;
+    /* access after which to signal each event, or 0 for never */
+    unsigned long irq_at, irq_cancel_at, nmi_at, reset_at;
+    /* hold RDY low for hold_cycles after every hold_every accesses */
+    unsigned long hold_every, hold_cycles;
+    int hold_repeat;
+};
+
+/* what to signal after an access */
+#define EVENT_NONE 0
+#define EVENT_IRQ 1
+#define EVENT_IRQ_CANCEL 2
+#define EVENT_NMI 3
+#define EVENT_RESET 4
+
+static int machine_access(struct machine *m, unsigned long kind,
+                          uint16_t addr, uint8_t value) {
+    unsigned long n = ++m->accesses;
+    m->hash = fnv(fnv(m->hash, kind | addr), value);
+    if (n == m->irq_at) return EVENT_IRQ;
+    if (n == m->irq_cancel_at) return EVENT_IRQ_CANCEL;
+    if (n == m->nmi_at) return EVENT_NMI;
+    if (n == m->reset_at) return EVENT_RESET;
+    return EVENT_NONE;
+}
+
+static int machine_hold(const struct machine *m) {
+    return m->hold_every && m->accesses % m->hold_every == 0;
+}
+
+static void exact_event(struct w65c02s_exact_cpu *cpu, struct machine *m,
+                        int event) {
+    switch (event) {
+    case EVENT_IRQ:         w65c02s_exact_irq(cpu); break;
+    case EVENT_IRQ_CANCEL:  w65c02s_exact_irq_cancel(cpu); break;
+    case EVENT_NMI:         w65c02s_exact_nmi(cpu); break;
+    case EVENT_RESET:       w65c02s_exact_reset(cpu); break;
+    }
+    if (machine_hold(m))
+        w65c02s_exact_hold_rdy(cpu, m->hold_cycles, m->hold_repeat);
+}
+
+static uint8_t exact_read(struct w65c02s_exact_cpu *cpu, uint16_t a) {
+    struct machine *m = w65c02s_exact_get_cpu_data(cpu);
+    exact_event(cpu, m, machine_access(m, 0x10000UL, a, m->mem[a]));
+    return m->mem[a];
+}
+
+static void exact_write(struct w65c02s_exact_cpu *cpu, uint16_t a,
+                        uint8_t v) {
+    struct machine *m = w65c02s_exact_get_cpu_data(cpu);
+    m->mem[a] = v;
+    exact_event(cpu, m, machine_access(m, 0x20000UL, a, v));
+}
+
+static void coarse_event(struct w65c02s_coarse_cpu *cpu, struct machine *m,
+                         int event) {
+    switch (event) {
+    case EVENT_IRQ:         w65c02s_coarse_irq(cpu); break;
+    case EVENT_IRQ_CANCEL:  w65c02s_coarse_irq_cancel(cpu); break;
+    case EVENT_NMI:         w65c02s_coarse_nmi(cpu); break;
+    case EVENT_RESET:       w65c02s_coarse_reset(cpu); break;
+    }
+    if (machine_hold(m))
+        w65c02s_coarse_hold_rdy(cpu, m->hold_cycles, m->hold_repeat);
+}
+
+static uint8_t coarse_read(struct w65c02s_coarse_cpu *cpu, uint16_t a) {
+    struct machine *m = w65c02s_coarse_get_cpu_data(cpu);
+    coarse_event(cpu, m, machine_access(m, 0x10000UL, a, m->mem[a]));
+    return m->mem[a];
+}
+
+static void coarse_write(struct w65c02s_coarse_cpu *cpu, uint16_t a,
+                         uint8_t v) {
+    struct machine *m = w65c02s_coarse_get_cpu_data(cpu);
+    m->mem[a] = v;
+    coarse_event(cpu, m, machine_access(m, 0x20000UL, a, v));
+}
+
+/* everything one thread needs to run cases */
+struct worker {
+    struct machine exact, coarse, whole;
+    /* the cpu structs are only declared here, see w65c02s_cpu_size.
+       whole_cpu is an exact core run in two calls, and moved_cpu takes
+       over its state in between */
+    struct w65c02s_exact_cpu *exact_cpu, *whole_cpu, *moved_cpu;
+    struct w65c02s_coarse_cpu *coarse_cpu;
+    unsigned long first, count, step; /* cases first + k * step, k < count */
+    unsigned long failures;
+    unsigned long reported;
+};
+
+static unsigned long seed = 1;
+static unsigned long *digests;
+
+static unsigned long state_digest(unsigned long hash,
+                                  const struct w65c02s_state *st) {
+    hash = fnv(hash, st->total_cycles);
+    hash = fnv(hash, st->total_instructions);
+    hash = fnv(hash, st->cpu_state);
+    hash = fnv(hash, st->int_trig);
+    hash = fnv(hash, st->pc);
+    hash = fnv(hash, st->a);
+    hash = fnv(hash, st->x);
+    hash = fnv(hash, st->y);
+    hash = fnv(hash, st->s);
+    hash = fnv(hash, st->p);
+    hash = fnv(hash, st->in_nmi | st->in_rst << 1 | st->in_irq << 2);
+    return hash;
+}
+
+static void print_state(const char *name, const struct w65c02s_state *st) {
+    printf("  %-6s PC=%04X A=%02X X=%02X Y=%02X S=%02X P=%02X "
+           "state=%02X/%02X cycles=%lu instructions=%lu\n", name,
+           st->pc, st->a, st->x, st->y, st->s, st->p,
+           st->cpu_state, st->int_trig,
+           st->total_cycles, st->total_instructions);
+}
+
+/* runs one case, returns whether the cores agree */
+static int run_case(struct worker *w, unsigned long n) {
+    struct w65c02s_exact_cpu *exact = w->exact_cpu;
+    struct w65c02s_exact_cpu *whole = w->whole_cpu;
+    struct w65c02s_exact_cpu *moved = w->moved_cpu;
+    struct w65c02s_coarse_cpu *coarse = w->coarse_cpu;
+    struct w65c02s_state st, es, cs, ws;
+    struct machine *em = &w->exact, *cm = &w->coarse, *wm = &w->whole;
+    unsigned long rng = fnv(fnv(2166136261UL, seed), n) | 1;
+    unsigned long cycles, half, i;
+    uint8_t wait_states[256];
+    const char *error = NULL;
+    int saved, stalls;
+
+    for (i = 0; i < 65536; i += 4) {
+        unsigned long r = xorshift(&rng);
+        em->mem[i] = (uint8_t)r;
+        em->mem[i + 1] = (uint8_t)(r >> 8);
+        em->mem[i + 2] = (uint8_t)(r >> 16);
+        em->mem[i + 3] = (uint8_t)(r >> 24);
+    }
+    em->hash = 2166136261UL;
+    em->accesses = 0;
+    em->irq_at = xorshift(&rng) % 256;
+    em->irq_cancel_at = em->irq_at + xorshift(&rng) % 64;
+    em->nmi_at = xorshift(&rng) % 512;
+    em->reset_at = xorshift(&rng) % 1024;
+    /* a hold must end before the next one, or it would never end */
+    em->hold_cycles = 1 + xorshift(&rng) % 4;
+    em->hold_every = em->hold_cycles + 1 + xorshift(&rng) % 32;
+    em->hold_repeat = xorshift(&rng) & 1;
+    memcpy(cm, em, sizeof(*cm));
+    memcpy(wm, em, sizeof(*wm));
+    for (i = 0; i < 256; ++i) {
+        unsigned long r = xorshift(&rng) % 16;
+        wait_states[i] = (uint8_t)(r < 3 ? 1 + r : 0);
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.pc = (uint16_t)xorshift(&rng);
+    st.a = (uint8_t)xorshift(&rng);
+    st.x = (uint8_t)xorshift(&rng);
+    st.y = (uint8_t)xorshift(&rng);
+    st.s = (uint8_t)xorshift(&rng);
+    st.p = (uint8_t)xorshift(&rng);
+
+    w65c02s_exact_init(exact, exact_read, exact_write, em);
+    w65c02s_exact_load_state(exact, &st);
+    w65c02s_coarse_init(coarse, coarse_read, coarse_write, cm);
+    w65c02s_coarse_load_state(coarse, &st);
+    w65c02s_exact_init(whole, exact_read, exact_write, wm);
+    w65c02s_exact_load_state(whole, &st);
+    w65c02s_exact_init(moved, exact_read, exact_write, wm);
+    stalls = 0;
+    for (i = 0; i < 256; ++i) {
+        stalls = w65c02s_exact_set_wait_states(exact, i, 1, wait_states[i]);
+        w65c02s_exact_set_wait_states(whole, i, 1, wait_states[i]);
+        w65c02s_exact_set_wait_states(moved, i, 1, wait_states[i]);
+        w65c02s_coarse_set_wait_states(coarse, i, 1, wait_states[i]);
+    }
+
+    /* the coarse core decides where the case ends */
+    if (xorshift(&rng) & 1)
+        cycles = w65c02s_coarse_run_instructions(coarse,
+                                        1 + xorshift(&rng) % 64, true);
+    else
+        cycles = w65c02s_coarse_run_cycles(coarse,
+                                        1 + xorshift(&rng) % 256);
+    for (i = 0; i < cycles; ) {
+        unsigned long chunk = 1 + xorshift(&rng) % 16;
+        if (chunk > cycles - i) chunk = cycles - i;
+        i += w65c02s_exact_run_cycles(exact, chunk);
+    }
+    memset(&ws, 0, sizeof(ws));
+    if (stalls) {
+        /* the state cannot be saved during a hold or wait states,
+           and loading it must drop the hold pending on moved */
+        half = xorshift(&rng) % (cycles + 1);
+        for (i = 0; i < half; )
+            i += w65c02s_exact_run_cycles(whole, half - i);
+        while (!w65c02s_exact_save_state(whole, &ws) && i < cycles)
+            i += w65c02s_exact_run_cycles(whole, 1);
+        w65c02s_exact_hold_rdy(moved, 1000, false);
+        w65c02s_exact_load_state(moved, &ws);
+        for (; i < cycles; )
+            i += w65c02s_exact_run_cycles(moved, cycles - i);
+        w65c02s_exact_save_state(moved, &ws);
+    }
+
+    w65c02s_coarse_save_state(coarse, &cs);
+    saved = w65c02s_exact_save_state(exact, &es);
+    if (!saved)
+        error = "exact core stopped in the middle of an instruction";
+    else if (es.total_cycles != cs.total_cycles)
+        error = "cycle counts differ";
+    else if (es.total_instructions != cs.total_instructions)
+        error = "instruction counts differ";
+    else if (em->accesses != cm->accesses || em->hash != cm->hash)
+        error = "bus accesses differ";
+    else if (state_digest(0, &es) != state_digest(0, &cs))
+        error = "registers or CPU state differ";
+    else if (memcmp(em->mem, cm->mem, sizeof(em->mem)))
+        error = "memory differs";
+    else if (stalls && (wm->accesses != em->accesses || wm->hash != em->hash
+                        || state_digest(0, &ws) != state_digest(0, &es)
+                        || memcmp(em->mem, wm->mem, sizeof(em->mem))))
+        error = "exact core depends on how the cycles are chunked "
+                "or on moving its state";
+
+    digests[n] = saved ? state_digest(em->hash, &es) : 0;
+    if (!error) return 1;
+    if (w->reported++ < MAX_REPORTS) {
+        printf("case %lu: %s (rerun with -s %lu -f %lu -n 1)\n",
+               n, error, seed, n);
+        print_state("start", &st);
+        if (saved) print_state("exact", &es);
+        print_state("coarse", &cs);
+        printf("  accesses: exact %lu, coarse %lu\n",
+               em->accesses, cm->accesses);
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    unsigned long k;
+    for (k = 0; k < w->count; ++k)
+        if (!run_case(w, w->first + k * w->step))
+            ++w->failures;
+    return NULL;
+}
+
+/* writes the digests of cases first..first+count-1 */
+static int write_digests(const char *name, unsigned long first,
+                         unsigned long count) {
+    unsigned long n;
+    FILE *file = fopen(name, "w");
+    if (!file) {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(file, "%lu\n", seed);
+    for (n = first; n < first + count; ++n)
+        fprintf(file, "%lu %08lx\n", n, digests[n]);
+    fclose(file);
+    return 1;
+}
+
+/* compares the digests against a file written with -w,
+   returns the number of mismatches or -1 on error */
+static long read_digests(const char *name, unsigned long first,
+                         unsigned long count) {
+    unsigned long n, digest, file_seed;
+    long mismatches = 0;
+    FILE *file = fopen(name, "r");
+    if (!file) {
+        perror("fopen");
+        return -1;
+    }
+    if (fscanf(file, "%lu", &file_seed) != 1 || file_seed != seed) {
+        fprintf(stderr, "%s: not recorded with seed %lu\n", name, seed);
+        fclose(file);
+        return -1;
+    }
+    while (fscanf(file, "%lu %lx", &n, &digest) == 2) {
+        if (n < first || n >= first + count || digests[n] == digest)
+            continue;
+        if (mismatches++ < MAX_REPORTS)
+            printf("case %lu: digest %08lx, recorded %08lx\n",
+                   n, digests[n], digest);
+    }
+    fclose(file);
+    return mismatches;
+}
+
+static void usage(const char *name) {
+    printf("%s [-n cases] [-f first_case] [-s seed] [-j threads] "
+           "[-w digest_file | -r digest_file]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    static struct worker *workers[MAX_THREADS];
+#if THREADS
+    pthread_t tids[MAX_THREADS];
+#endif
+    unsigned long first = 0, count = 100000, failures = 0, threads = 1;
+    const char *write_name = NULL, *read_name = NULL;
+    long mismatches = 0;
+    time_t start;
+    int i;
+
+#if THREADS && defined(_SC_NPROCESSORS_ONLN)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 0) threads = cpus;
+    }
+#endif
+    for (i = 1; i < argc; ++i) {
+        const char *opt = argv[i];
+        const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+        if (opt[0] != '-' || !opt[1] || opt[2] || !arg) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        ++i;
+        switch (opt[1]) {
+        case 'n': count = strtoul(arg, NULL, 0); break;
+        case 'f': first = strtoul(arg, NULL, 0); break;
+        case 's': seed = strtoul(arg, NULL, 0); break;
+        case 'j': threads = strtoul(arg, NULL, 0); break;
+        case 'w': write_name = arg; break;
+        case 'r': read_name = arg; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+#if !THREADS
+    threads = 1;
+#endif
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads > count) threads = count ? count : 1;
+
+    digests = malloc((first + count) * sizeof(*digests));
+    if (!digests) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < (int)threads; ++i) {
+        struct worker *w = calloc(1, sizeof(*w));
+        if (w) {
+            w->exact_cpu = malloc(w65c02s_exact_cpu_size());
+            w->whole_cpu = malloc(w65c02s_exact_cpu_size());
+            w->moved_cpu = malloc(w65c02s_exact_cpu_size());
+            w->coarse_cpu = malloc(w65c02s_coarse_cpu_size());
+        }
+        if (!w || !w->exact_cpu || !w->whole_cpu || !w->moved_cpu
+               || !w->coarse_cpu) {
+            fprintf(stderr, "out of memory\n");
+            return EXIT_FAILURE;
+        }
+        w->first = first + i;
+        w->step = threads;
+        w->count = count / threads + (i < (int)(count % threads));
+        workers[i] = w;
+    }
+
+    w65c02s_exact_init_decimal_tables();
+    w65c02s_coarse_init_decimal_tables();
+    printf("Running %lu cases from %lu with seed %lu on %lu threads\n",
+           count, first, seed, threads);
+    start = time(NULL);
+#if THREADS
+    for (i = 1; i < (int)threads; ++i) {
+        if (pthread_create(&tids[i], NULL, worker_main, workers[i])) {
+            fprintf(stderr, "could not start thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+#endif
+    worker_main(workers[0]);
+    for (i = 0; i < (int)threads; ++i) {
+#if THREADS
+        if (i) pthread_join(tids[i], NULL);
+#endif
+        failures += workers[i]->failures;
+        free(workers[i]->exact_cpu);
+        free(workers[i]->whole_cpu);
+        free(workers[i]->moved_cpu);
+        free(workers[i]->coarse_cpu);
+        free(workers[i]);
+    }
+    printf("%lu cases in %.0f s, %lu failed\n", count,
+           difftime(time(NULL), start), failures);
+
+    if (write_name && !write_digests(write_name, first, count))
+        return EXIT_FAILURE;
+    if (read_name) {
+        mismatches = read_digests(read_name, first, count);
+        if (mismatches < 0) return EXIT_FAILURE;
+        printf("%ld cases differ from %s\n", mismatches, read_name);
+    }
+    free(digests);
+    return failures || mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+/*******************************************************************************
+            w65c02s.h -- cycle-accurate C emulator of the WDC 65C02S
+                         as a single-header library
+            by ziplantil 2022 -- under the CC0 license
+            version: 2022-11-05
+
+            fuzzcore.c - one of the cores compared by fuzz.c
+*******************************************************************************/
+
+/* compiled twice by the Makefile: once with W65C02S_PREFIX=w65c02s_exact_
+   and W65C02S_COARSE=0, once with W65C02S_PREFIX=w65c02s_coarse_ and
+   W65C02S_COARSE=1. other defines (FUZZFLAGS) are given to both. */
+
+#define W65C02S_IMPL 1
+#include "w65c02s.h"
@@ -0,0 +1,160 @@
+/*******************************************************************************
+            w65c02s.h -- cycle-accurate C emulator of the WDC 65C02S
+                         as a single-header library
+            by ziplantil 2022 -- under the CC0 license
+            version: 2022-11-05
+
+            image.h - memory image loading for the test programs
+*******************************************************************************/
+
+/* ROM images are mapped read-only. Map each ROM once and give the same
+   pointer to every CPU; all of them then share the same physical pages,
+   which are also shared with other processes mapping the same file.
+
+   RAM images are mapped copy-on-write into a 64 KiB area. A CPU only gets
+   a private copy of a page once it writes to it, so loading an image for
+   thousands of CPUs costs almost nothing until they start writing.
+
+   Where mmap is not available (or not declared, e.g. with -ansi), both
+   fall back to reading the file into allocated memory. image_read reads
+   a file into memory the caller already has, such as a static array.
+
+   The functions are defined here, so include this in only one file. */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef MAP_ANONYMOUS
+#define IMAGE_MMAP 1
+#else
+#define IMAGE_MMAP 0
+#endif
+
+#define IMAGE_RAM_SIZE 0x10000UL
+
+/* reads up to max bytes of filename into buf, returns the number read */
+size_t image_read(const char *filename, void *buf, size_t max) {
+    FILE *file = fopen(filename, "rb");
+    size_t size;
+    if (!file) {
+        perror("fopen");
+        return 0;
+    }
+    size = fread(buf, 1, max, file);
+    fclose(file);
+    return size;
+}
+
+#if IMAGE_MMAP
+/* opens filename and returns its size in *size, or -1 on failure */
+int image_open(const char *filename, size_t *size) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        fprintf(stderr, "%s: empty or unreadable image\n", filename);
+        close(fd);
+        return -1;
+    }
+    *size = (size_t)st.st_size;
+    return fd;
+}
+#endif
+
+/* maps a ROM image read-only. returns NULL on failure.
+   the size of the image is stored in *size. */
+const unsigned char *image_map_rom(const char *filename, size_t *size) {
+#if IMAGE_MMAP
+    void *p;
+    int fd = image_open(filename, size);
+    if (fd < 0) return NULL;
+    p = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return p;
+#else
+    unsigned char *p = malloc(IMAGE_RAM_SIZE);
+    if (!p) return NULL;
+    *size = image_read(filename, p, IMAGE_RAM_SIZE);
+    if (!*size) {
+        free(p);
+        return NULL;
+    }
+    return p;
+#endif
+}
+
+/* returns a 64 KiB RAM area with the image (at most 64 KiB of it) at the
+   start and zeroes after it. returns NULL on failure. the number of bytes
+   loaded from the image is stored in *size. filename may be NULL, in which
+   case the area is all zeroes. */
+unsigned char *image_map_ram(const char *filename, size_t *size) {
+#if IMAGE_MMAP
+    void *p;
+    int fd = -1;
+    *size = 0;
+    p = mmap(NULL, IMAGE_RAM_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    if (!filename) return p;
+    fd = image_open(filename, size);
+    if (fd < 0) {
+        munmap(p, IMAGE_RAM_SIZE);
+        return NULL;
+    }
+    if (*size > IMAGE_RAM_SIZE) *size = IMAGE_RAM_SIZE;
+    /* the tail of the last page past the end of the file reads as zero */
+    if (mmap(p, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, 0) == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        munmap(p, IMAGE_RAM_SIZE);
+        return NULL;
+    }
+    close(fd);
+    return p;
+#else
+    unsigned char *p = calloc(1, IMAGE_RAM_SIZE);
+    *size = 0;
+    if (!p || !filename) return p;
+    *size = image_read(filename, p, IMAGE_RAM_SIZE);
+    if (!*size) {
+        free(p);
+        return NULL;
+    }
+    return p;
+#endif
+}
+
+/* releases a ROM image (size as returned by image_map_rom)
+   or a RAM image (size IMAGE_RAM_SIZE) */
+void image_unmap(const void *p, size_t size) {
+#if IMAGE_MMAP
+    munmap((void *)p, size);
+#else
+    (void)size;
+    free((void *)p);
+#endif
+}
+
+#endif /* IMAGE_H */
@@ -14,9 +14,11 @@
 
 #define W65C02S_IMPL 1
 #define W65C02S_LINK 1
+#define W65C02S_DISASM 1
 #include "w65c02s.h"
+#include "image.h"
 
-uint8_t ram[65536];
+uint8_t *ram;
 uint8_t breakpoints[65536];
 
 uint8_t w65c02s_read(uint16_t a) {
@@ -43,16 +45,19 @@ static uint16_t dumpmem(uint16_t start) {
 }
 
 static void loadmemfromfile(const char *filename, uint16_t offset) {
-    FILE *file = fopen(filename, "rb");
-    size_t size = 0;
+    size_t size = 0, mapped;
+    const unsigned char *image = image_map_rom(filename, &mapped);
 
-    if (!file) {
-        perror("fopen");
+    if (!image) {
+        puts("0");
         return;
     }
 
-    size = fread(&ram[offset], 1, 0x10000UL - offset, file);
-    fclose(file);
+    /* the image goes on top of what is already in memory */
+    size = mapped;
+    if (size > IMAGE_RAM_SIZE - offset) size = IMAGE_RAM_SIZE - offset;
+    memcpy(&ram[offset], image, size);
+    image_unmap(image, mapped);
 
     if (!size)
         puts("0");
@@ -67,7 +72,7 @@ static void dumpmemtofile(const char *filename) {
         return;
     }
 
-    if (!fwrite(ram, sizeof(ram), 1, file)) {
+    if (!fwrite(ram, IMAGE_RAM_SIZE, 1, file)) {
         perror("fwrite");
     }
     fclose(file);
@@ -818,414 +823,28 @@ line_error:
     }
 }
 
-char disasm_buf[64];
-char *disasm_ptr;
-
-static void disasmoutchr(char c) {
-    char *disasm_end = disasm_buf + sizeof(disasm_buf);
-    if (disasm_ptr < disasm_end) *disasm_ptr++ = c;
-}
-
-static void disasmoutstr(const char *s) {
-    char *disasm_end = disasm_buf + sizeof(disasm_buf);
-    if (disasm_ptr < disasm_end) {
-        int n = sprintf(disasm_ptr, "%s", s);
-        disasm_ptr += n;
-    }
-}
-
-static void disasmoutzp(uint16_t pzp) {
-    char *disasm_end = disasm_buf + sizeof(disasm_buf);
-    if (disasm_ptr < disasm_end) {
-        uint8_t zp = ram[pzp];
-        int n = sprintf(disasm_ptr, "$%02X", zp);
-        disasm_ptr += n;
-    }
-}
-
-static void disasmoutabs(uint16_t pabs) {
-    char *disasm_end = disasm_buf + sizeof(disasm_buf);
-    if (disasm_ptr < disasm_end) {
-        uint16_t abs = ram[pabs++];
-        int n;
-        abs |= ram[pabs] << 8;
-        n = sprintf(disasm_ptr, "$%04X", abs);
-        disasm_ptr += n;
-    }
-}
-
-static unsigned disasm_0(uint16_t ptr) {
-    return 0;
-}
-
-static unsigned disasm_imm(uint16_t ptr) {
-    disasmoutchr('#');
-    disasmoutzp(ptr);
-    return 1;
-}
-
-static unsigned disasm_zp(uint16_t ptr) {
-    disasmoutzp(ptr);
-    return 1;
-}
-
-static unsigned disasm_zpx(uint16_t ptr) {
-    disasmoutzp(ptr);
-    disasmoutstr(",X");
-    return 1;
-}
-
-static unsigned disasm_zpy(uint16_t ptr) {
-    disasmoutzp(ptr);
-    disasmoutstr(",Y");
-    return 1;
-}
-
-static unsigned disasm_zpr(uint16_t ptr) {
-    disasmoutzp(ptr++);
-    disasmoutchr(',');
-    disasmoutzp(ptr++);
-    return 2;
-}
-
-static unsigned disasm_izp(uint16_t ptr) {
-    disasmoutchr('(');
-    disasmoutzp(ptr);
-    disasmoutchr(')');
-    return 1;
-}
-
-static unsigned disasm_izx(uint16_t ptr) {
-    disasmoutchr('(');
-    disasmoutzp(ptr);
-    disasmoutstr(",X");
-    disasmoutchr(')');
-    return 1;
-}
-
-static unsigned disasm_izy(uint16_t ptr) {
-    disasmoutchr('(');
-    disasmoutzp(ptr);
-    disasmoutstr("),Y");
-    return 1;
-}
-
-static unsigned disasm_abs(uint16_t ptr) {
-    disasmoutabs(ptr);
-    return 2;
-}
-
-static unsigned disasm_abx(uint16_t ptr) {
-    disasmoutabs(ptr);
-    disasmoutstr(",X");
-    return 2;
-}
-
-static unsigned disasm_aby(uint16_t ptr) {
-    disasmoutabs(ptr);
-    disasmoutstr(",Y");
-    return 2;
-}
-
-static unsigned disasm_ind(uint16_t ptr) {
-    disasmoutchr('(');
-    disasmoutabs(ptr);
-    disasmoutchr(')');
-    return 2;
-}
-
-static unsigned disasm_iax(uint16_t ptr) {
-    disasmoutchr('(');
-    disasmoutabs(ptr);
-    disasmoutstr(",X)");
-    return 2;
-}
-
-typedef unsigned (*disasm_mode)(uint16_t);
-
-struct disasm_opcode {
-    const char *mnemonic;
-    disasm_mode disassemble;
-};
-
-struct disasm_opcode disasm_opcode_table[] = {
-    { "BRK", &disasm_imm },
-    { "ORA", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "TSB", &disasm_zp },
-    { "ORA", &disasm_zp },
-    { "ASL", &disasm_zp },
-    { "RMB0", &disasm_zp },
-    { "PHP", &disasm_0 },
-    { "ORA", &disasm_imm },
-    { "ASL", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "TSB", &disasm_abs },
-    { "ORA", &disasm_abs },
-    { "ASL", &disasm_abs },
-    { "BBR0", &disasm_zpr },
-    { "BPL", &disasm_zp },
-    { "ORA", &disasm_izy },
-    { "ORA", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "TRB", &disasm_zp },
-    { "ORA", &disasm_zpx },
-    { "ASL", &disasm_zpx },
-    { "RMB1", &disasm_zp },
-    { "CLC", &disasm_0 },
-    { "ORA", &disasm_aby },
-    { "INC", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "TRB", &disasm_abs },
-    { "ORA", &disasm_abx },
-    { "ASL", &disasm_abx },
-    { "BBR1", &disasm_zpr },
-    { "JSR", &disasm_abs },
-    { "AND", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "BIT", &disasm_zp },
-    { "AND", &disasm_zp },
-    { "ROL", &disasm_zp },
-    { "RMB2", &disasm_zp },
-    { "PLP", &disasm_0 },
-    { "AND", &disasm_imm },
-    { "ROL", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "BIT", &disasm_abs },
-    { "AND", &disasm_abs },
-    { "ROL", &disasm_abs },
-    { "BBR2", &disasm_zpr },
-    { "BMI", &disasm_zp },
-    { "AND", &disasm_izy },
-    { "AND", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "BIT", &disasm_zpx },
-    { "AND", &disasm_zpx },
-    { "ROL", &disasm_zpx },
-    { "RMB3", &disasm_zp },
-    { "SEC", &disasm_0 },
-    { "AND", &disasm_aby },
-    { "DEC", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "BIT", &disasm_abx },
-    { "AND", &disasm_abx },
-    { "ROL", &disasm_abx },
-    { "BBR3", &disasm_zpr },
-    { "RTI", &disasm_0 },
-    { "EOR", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_zp },
-    { "EOR", &disasm_zp },
-    { "LSR", &disasm_zp },
-    { "RMB4", &disasm_zp },
-    { "PHA", &disasm_0 },
-    { "EOR", &disasm_imm },
-    { "LSR", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "JMP", &disasm_abs },
-    { "EOR", &disasm_abs },
-    { "LSR", &disasm_abs },
-    { "BBR4", &disasm_zpr },
-    { "BVC", &disasm_zp },
-    { "EOR", &disasm_izy },
-    { "EOR", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_zpx },
-    { "EOR", &disasm_zpx },
-    { "LSR", &disasm_zpx },
-    { "RMB5", &disasm_zp },
-    { "CLI", &disasm_0 },
-    { "EOR", &disasm_aby },
-    { "PHY", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_abs },
-    { "EOR", &disasm_abx },
-    { "LSR", &disasm_abx },
-    { "BBR5", &disasm_zpr },
-    { "RTS", &disasm_0 },
-    { "ADC", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "STZ", &disasm_zp },
-    { "ADC", &disasm_zp },
-    { "ROR", &disasm_zp },
-    { "RMB6", &disasm_zp },
-    { "PLA", &disasm_0 },
-    { "ADC", &disasm_imm },
-    { "ROR", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "JMP", &disasm_ind },
-    { "ADC", &disasm_abs },
-    { "ROR", &disasm_abs },
-    { "BBR6", &disasm_zpr },
-    { "BVS", &disasm_zp },
-    { "ADC", &disasm_izy },
-    { "ADC", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "STZ", &disasm_zpx },
-    { "ADC", &disasm_zpx },
-    { "ROR", &disasm_zpx },
-    { "RMB7", &disasm_zp },
-    { "SEI", &disasm_0 },
-    { "ADC", &disasm_aby },
-    { "PLY", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "JMP", &disasm_iax },
-    { "ADC", &disasm_abx },
-    { "ROR", &disasm_abx },
-    { "BBR7", &disasm_zpr },
-    { "BRA", &disasm_zp },
-    { "STA", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "STY", &disasm_zp },
-    { "STA", &disasm_zp },
-    { "STX", &disasm_zp },
-    { "SMB0", &disasm_zp },
-    { "DEY", &disasm_0 },
-    { "BIT", &disasm_imm },
-    { "TXA", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "STY", &disasm_abs },
-    { "STA", &disasm_abs },
-    { "STX", &disasm_abs },
-    { "BBS0", &disasm_zpr },
-    { "BCC", &disasm_zp },
-    { "STA", &disasm_izy },
-    { "STA", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "STY", &disasm_zpx },
-    { "STA", &disasm_zpx },
-    { "STX", &disasm_zpy },
-    { "SMB1", &disasm_zp },
-    { "TYA", &disasm_0 },
-    { "STA", &disasm_aby },
-    { "TXS", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "STZ", &disasm_abs },
-    { "STA", &disasm_abx },
-    { "STZ", &disasm_abx },
-    { "BBS1", &disasm_zpr },
-    { "LDY", &disasm_imm },
-    { "LDA", &disasm_izx },
-    { "LDX", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "LDY", &disasm_zp },
-    { "LDA", &disasm_zp },
-    { "LDX", &disasm_zp },
-    { "SMB2", &disasm_zp },
-    { "TAY", &disasm_0 },
-    { "LDA", &disasm_imm },
-    { "TAX", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "LDY", &disasm_abs },
-    { "LDA", &disasm_abs },
-    { "LDX", &disasm_abs },
-    { "BBS2", &disasm_zpr },
-    { "BCS", &disasm_zp },
-    { "LDA", &disasm_izy },
-    { "LDA", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "LDY", &disasm_zpx },
-    { "LDA", &disasm_zpx },
-    { "LDX", &disasm_zpy },
-    { "SMB3", &disasm_zp },
-    { "CLV", &disasm_0 },
-    { "LDA", &disasm_aby },
-    { "TSX", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "LDY", &disasm_abx },
-    { "LDA", &disasm_abx },
-    { "LDX", &disasm_aby },
-    { "BBS3", &disasm_zpr },
-    { "CPY", &disasm_imm },
-    { "CMP", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "CPY", &disasm_zp },
-    { "CMP", &disasm_zp },
-    { "DEC", &disasm_zp },
-    { "SMB4", &disasm_zp },
-    { "INY", &disasm_0 },
-    { "CMP", &disasm_imm },
-    { "DEX", &disasm_0 },
-    { "WAI", &disasm_0 },
-    { "CPY", &disasm_abs },
-    { "CMP", &disasm_abs },
-    { "DEC", &disasm_abs },
-    { "BBS4", &disasm_zpr },
-    { "BNE", &disasm_zp },
-    { "CMP", &disasm_izy },
-    { "CMP", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_zpx },
-    { "CMP", &disasm_zpx },
-    { "DEC", &disasm_zpx },
-    { "SMB5", &disasm_zp },
-    { "CLD", &disasm_0 },
-    { "CMP", &disasm_aby },
-    { "PHX", &disasm_0 },
-    { "STP", &disasm_0 },
-    { "NOP", &disasm_abs },
-    { "CMP", &disasm_abx },
-    { "DEC", &disasm_abx },
-    { "BBS5", &disasm_zpr },
-    { "CPX", &disasm_imm },
-    { "SBC", &disasm_izx },
-    { "NOP", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "CPX", &disasm_zp },
-    { "SBC", &disasm_zp },
-    { "INC", &disasm_zp },
-    { "SMB6", &disasm_zp },
-    { "INX", &disasm_0 },
-    { "SBC", &disasm_imm },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "CPX", &disasm_abs },
-    { "SBC", &disasm_abs },
-    { "INC", &disasm_abs },
-    { "BBS6", &disasm_zpr },
-    { "BEQ", &disasm_zp },
-    { "SBC", &disasm_izy },
-    { "SBC", &disasm_izp },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_zpx },
-    { "SBC", &disasm_zpx },
-    { "INC", &disasm_zpx },
-    { "SMB7", &disasm_zp },
-    { "SED", &disasm_0 },
-    { "SBC", &disasm_aby },
-    { "PLX", &disasm_0 },
-    { "NOP", &disasm_0 },
-    { "NOP", &disasm_abs },
-    { "SBC", &disasm_abx },
-    { "INC", &disasm_abx },
-    { "BBS7", &disasm_zpr },
-};
-
 static void disassemble(void) {
-    struct disasm_opcode *op = &disasm_opcode_table[ram[address_disasm]];
+    struct w65c02s_disasm insn;
+    char operand[W65C02S_DISASM_OPERAND_SIZE];
+    uint8_t bytes[3];
     unsigned i, len;
 
-    disasm_ptr = disasm_buf;
-    len = (*op->disassemble)(address_disasm + 1);
-    
+    /* the instruction may wrap around to $0000 */
+    for (i = 0; i < 3; ++i) bytes[i] = ram[(uint16_t)(address_disasm + i)];
+    len = w65c02s_disassemble(&insn, address_disasm, bytes);
+    w65c02s_disasm_operand(&insn, operand);
+
     printf("$%04X\t", address_disasm);
-    for (i = 0; i <= len; ++i) {
+    for (i = 0; i < len; ++i) {
         printf("%02X ", ram[address_disasm++]);
     }
-    for (i = len; i <= 3; ++i) {
+    for (i = len; i <= 4; ++i) {
         printf("   ");
     }
     putchar('\t');
-    printf("%s", op->mnemonic);
+    printf("%s", insn.mnemonic);
     putchar('\t');
-    *disasm_ptr = 0;
-    printf("%s\n", disasm_buf);
+    printf("%s\n", operand);
 }
 
 const char p_flags[8] = "NV--DIZC";
@@ -1487,6 +1106,9 @@ static void processline(void) {
 }
 
 int main(int argc, char *argv[]) {
+    size_t size;
+    ram = image_map_ram(NULL, &size);
+    if (!ram) return EXIT_FAILURE;
     w65c02s_init(&cpu, NULL, NULL, NULL);
     while (run && readline(">>> ")) processline();
     return 0;